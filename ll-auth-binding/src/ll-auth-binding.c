@@ -1,19 +1,29 @@
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <sys/eventfd.h>
 #include <json-c/json.h>
 #include <security/pam_appl.h>
 #include <security/pam_misc.h>
 #include <libudev.h>
+#include <systemd/sd-event.h>
 #include <pthread.h>
-#include <poll.h>
 
 #define AFB_BINDING_VERSION 2
 #include <afb/afb-binding.h>
 
 // Defines
 #define PAM_RULE													"agl"
-#define UDEV_MONITOR_POLLING_TIMEOUT								5000
+#define SEAT_DEFAULT												"seat0"
+#define SESSIONS_BUCKETS_MIN										16
+#define AUTH_WORKERS_DEFAULT										2
+#define AUTH_WORKERS_MAX											16
+
+#define UDEV_RECEIVE_BUFFER_SIZE									(8 * 1024 * 1024)
 
 #define UDEV_ACTION_UNSUPPORTED										0
 #define UDEV_ACTION_ADD												1
@@ -27,40 +37,155 @@
 #define LOGIN_ERROR_PAM_ACCT_MGMT									5
 #define LOGIN_ERROR_PAM_NO_USER										6
 #define LOGIN_ERROR_PAM_END											7
+#define LOGIN_ERROR_OUT_OF_MEMORY									8
+#define LOGIN_ERROR_CANCELED										9
 
 // Globals
 static const char* error_messages[] =
 {
 	"",
-	"The current user must be logged out first!",
+	"The user of the seat must be logged out first!",
 	"PAM start failed!",
 	"PAM putenv failed!",
 	"PAM authenticate failed!",
 	"PAM acct_mgmt failed!",
 	"No user provided by the PAM module!",
-	"PAM end failed!"
+	"PAM end failed!",
+	"Out of memory!",
+	"The device was unplugged during its authentication!"
 };
 
-static char*					current_device						= NULL;
-static char*					current_user						= NULL;
+/**
+ * A session: a user logged in with a device on a seat. The sessions are
+ * in one hash table per index: by device, by user and by seat. A seat
+ * and a device have at most one session, a user may have several.
+ * The table is only used by the thread of the event loop, that logs in
+ * and out: the verbs read the snapshot it publishes.
+ */
+enum session_index
+{
+	BY_DEVICE,
+	BY_USER,
+	BY_SEAT,
+	SESSION_INDEXES
+};
+
+struct session
+{
+	char* keys[SESSION_INDEXES];
+	struct session* next[SESSION_INDEXES];
+};
+
+struct session_table
+{
+	struct session** buckets;
+	size_t size;
+};
+
+static struct session_table		sessions[SESSION_INDEXES];
+static size_t					sessions_count						= 0;
+
+/**
+ * A snapshot: an immutable copy of the sessions, with its own hash
+ * tables of indexes of entries. A new snapshot is published after each
+ * change and the verbs read the current one without lock. A change
+ * whose snapshot can't be built is refused, so that the published
+ * snapshot never misses one. A replaced snapshot is retired at the
+ * current epoch and freed once no reader is in that epoch or an older
+ * one. A reader announces the epoch in its slot before reading the
+ * snapshot and clears it when done.
+ */
+struct snapshot_entry
+{
+	const char* keys[SESSION_INDEXES];
+	uint32_t next[SESSION_INDEXES];			/* 1 + index of the next entry in the bucket, 0 ends */
+};
+
+struct snapshot
+{
+	struct snapshot* retired;				/* next retired snapshot */
+	unsigned long long epoch;				/* epoch of its retirement */
+	size_t count;							/* count of entries */
+	size_t size;							/* count of buckets by index, a power of 2 */
+	uint32_t* buckets[SESSION_INDEXES];		/* 1 + index of the first entry of the buckets, 0 if empty */
+	struct snapshot_entry entries[];
+};
+
+struct snapshot_reader
+{
+	struct snapshot_reader* next;
+	int owned;
+	unsigned long long epoch;				/* epoch of the reading or 0 */
+};
+
+static struct snapshot*			snapshot							= NULL;
+static struct snapshot*			snapshots_retired					= NULL;
+static unsigned long long		snapshot_epoch						= 1;
+static struct snapshot_reader*	snapshot_readers					= NULL;
+static pthread_mutex_t			snapshot_readers_mutex				= PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t			snapshot_readers_once				= PTHREAD_ONCE_INIT;
+static pthread_key_t			snapshot_reader_key;
+static __thread struct snapshot_reader* snapshot_reader				= NULL;
+/**
+ * An authentication: PAM runs in a pool of workers, out of the event
+ * loop. The authentications are listed in the order of the plugs and
+ * their results are delivered in this order by the event loop, woken
+ * up by the workers with an eventfd. The unplug of a device cancels its
+ * pending authentication: it is dropped if no worker took it yet, else
+ * its result is ignored.
+ */
+enum auth_state
+{
+	AUTH_QUEUED,
+	AUTH_RUNNING,
+	AUTH_DONE
+};
+
+struct auth
+{
+	struct auth* next;
+	enum auth_state state;
+	int canceled;
+	int ret;
+	char* user;
+	char* device;
+	char* seat;
+};
+
+static struct auth*				auths								= NULL;
+static struct auth**			auths_tail							= &auths;
+static pthread_mutex_t			auths_mutex							= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t			auths_cond							= PTHREAD_COND_INITIALIZER;
+static int						auths_fd							= -1;
+static sd_event_source*			auths_source						= NULL;
+
 static struct pam_conv			conv								= { misc_conv, NULL };
 static struct udev*				udev_context						= NULL;
 static struct udev_monitor*		udev_mon							= NULL;
-static pthread_t				udev_monitoring_thread_handle;
-static struct afb_event			evt_login, evt_logout, evt_failed;
+static sd_event_source*			udev_source							= NULL;
+static unsigned long long		udev_delivered						= 0;
+static unsigned long long		udev_filtered						= 0;
 
 /**
- * @brief Free the memory associated to the specified string and nullify the pointer.
- * @param[in] string A pointer to the string.
+ * A match of a property of the devices, in user space after the kernel's
+ * filter by subsystem, devtype and tag. The pattern, a shell wildcard,
+ * is read from the environment variable, no pattern matches all.
  */
-static inline void free_string(char** string)
+struct udev_match
 {
-	if (string)
-	{
-		if (*string) free(*string);
-		*string = NULL;
-	}
-}
+	const char* variable;
+	const char* property;
+	const char* pattern;
+};
+
+static struct udev_match		udev_matches[]						=
+{
+	{ "LL_AUTH_BUS",		"ID_BUS",		NULL },
+	{ "LL_AUTH_VENDOR",		"ID_VENDOR",	NULL },
+	{ "LL_AUTH_MODEL",		"ID_MODEL",		NULL },
+	{ "LL_AUTH_SERIAL",		"ID_SERIAL",	NULL }
+};
+static struct afb_event			evt_login, evt_logout, evt_failed;
 
 /**
  * @brief Free the memory associated to the specified UDev's context and nullify the pointer.
@@ -88,6 +213,19 @@ static inline void free_udev_monitor(struct udev_monitor** mon)
 	}
 }
 
+/**
+ * @brief Release the specified event source and nullify the pointer.
+ * @param[in] source The event source.
+ */
+static inline void free_event_source(sd_event_source** source)
+{
+	if (source)
+	{
+		if (*source) sd_event_source_unref(*source);
+		*source = NULL;
+	}
+}
+
 /**
  * @brief Print UDev infos for the specified device.
  * @param[in] dev The device.
@@ -120,20 +258,398 @@ static inline int udev_device_get_action_int(struct udev_device* dev)
 		: UDEV_ACTION_ADD;
 }
 
+/**
+ * @brief Hash a string (FNV-1a).
+ * @param[in] string The string.
+ * @return The hash.
+ */
+static size_t hash_string(const char* string)
+{
+	size_t hash = (size_t)14695981039346656037ULL;
+
+	while (*string)
+		hash = (hash ^ (unsigned char)*string++) * (size_t)1099511628211ULL;
+	return hash;
+}
+
+/**
+ * @brief Get the bucket of a key in the specified index.
+ * Only called by the thread of the event loop.
+ * @param[in] index The index.
+ * @param[in] key The key.
+ * @return The head of the bucket's list.
+ */
+static inline struct session** session_bucket(enum session_index index, const char* key)
+{
+	return &sessions[index].buckets[hash_string(key) & (sessions[index].size - 1)];
+}
+
+/**
+ * @brief Find a session by key.
+ * Only called by the thread of the event loop.
+ * @param[in] index The index to search.
+ * @param[in] key The device, user or seat.
+ * @return The first session matching, NULL if none.
+ */
+static struct session* session_find(enum session_index index, const char* key)
+{
+	struct session* session;
+
+	if (!sessions[index].size)
+		return NULL;
+	for (session = *session_bucket(index, key) ; session ; session = session->next[index])
+		if (!strcmp(session->keys[index], key))
+			return session;
+	return NULL;
+}
+
+/**
+ * @brief Double the buckets of the tables when they are full.
+ * Only called by the thread of the event loop.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int sessions_grow()
+{
+	struct session** buckets[SESSION_INDEXES];
+	struct session* session;
+	struct session* next;
+	size_t size, i, oldsize;
+	int index;
+
+	oldsize = sessions[0].size;
+	if (sessions_count < oldsize)
+		return 0;
+	size = oldsize ? 2 * oldsize : SESSIONS_BUCKETS_MIN;
+	for (index = 0 ; index < SESSION_INDEXES ; index++)
+	{
+		buckets[index] = calloc(size, sizeof(struct session*));
+		if (!buckets[index])
+		{
+			while (index)
+				free(buckets[--index]);
+			return -1;
+		}
+	}
+
+	for (index = 0 ; index < SESSION_INDEXES ; index++)
+	{
+		for (i = 0 ; i < oldsize ; i++)
+		{
+			for (session = sessions[index].buckets[i] ; session ; session = next)
+			{
+				next = session->next[index];
+				session->next[index] = buckets[index][hash_string(session->keys[index]) & (size - 1)];
+				buckets[index][hash_string(session->keys[index]) & (size - 1)] = session;
+			}
+		}
+		free(sessions[index].buckets);
+		sessions[index].buckets = buckets[index];
+		sessions[index].size = size;
+	}
+	return 0;
+}
+
+/**
+ * @brief Add a session.
+ * Only called by the thread of the event loop.
+ * @param[in] device The device.
+ * @param[in] user The user.
+ * @param[in] seat The seat.
+ * @return The session, NULL if out of memory.
+ */
+static struct session* session_add(const char* device, const char* user, const char* seat)
+{
+	struct session* session;
+	struct session** bucket;
+	int index;
+
+	if (sessions_grow() < 0)
+		return NULL;
+
+	session = calloc(1, sizeof *session);
+	if (!session)
+		return NULL;
+	session->keys[BY_DEVICE] = strdup(device);
+	session->keys[BY_USER] = strdup(user);
+	session->keys[BY_SEAT] = strdup(seat);
+	if (!session->keys[BY_DEVICE] || !session->keys[BY_USER] || !session->keys[BY_SEAT])
+	{
+		for (index = 0 ; index < SESSION_INDEXES ; index++)
+			free(session->keys[index]);
+		free(session);
+		return NULL;
+	}
+
+	for (index = 0 ; index < SESSION_INDEXES ; index++)
+	{
+		bucket = session_bucket(index, session->keys[index]);
+		session->next[index] = *bucket;
+		*bucket = session;
+	}
+	sessions_count++;
+	return session;
+}
+
+/**
+ * @brief Remove and free a session.
+ * Only called by the thread of the event loop.
+ * @param[in] session The session.
+ */
+static void session_remove(struct session* session)
+{
+	struct session** prv;
+	int index;
+
+	for (index = 0 ; index < SESSION_INDEXES ; index++)
+	{
+		for (prv = session_bucket(index, session->keys[index]) ; *prv != session ; prv = &(*prv)->next[index]);
+		*prv = session->next[index];
+		free(session->keys[index]);
+	}
+	free(session);
+	sessions_count--;
+}
+
+/**
+ * @brief Describe a session.
+ * @param[in] session The session.
+ * @return A json object with the device, the user and the seat.
+ */
+static struct json_object* session_to_json(struct session* session)
+{
+	struct json_object* result = json_object_new_object();
+
+	json_object_object_add(result, "device", json_object_new_string(session->keys[BY_DEVICE]));
+	json_object_object_add(result, "user", json_object_new_string(session->keys[BY_USER]));
+	json_object_object_add(result, "seat", json_object_new_string(session->keys[BY_SEAT]));
+	return result;
+}
+
+/**
+ * @brief Build a snapshot of the sessions.
+ * @param[in] excluded A session left out of the snapshot, may be NULL.
+ * @return The snapshot, NULL if out of memory.
+ */
+static struct snapshot* snapshot_build(const struct session* excluded)
+{
+	struct snapshot* snap;
+	struct snapshot_entry* entry;
+	struct session* session;
+	size_t size, count, strings, length, i, h;
+	uint32_t n;
+	char* p;
+	int index;
+
+	count = sessions_count - (excluded != NULL);
+	strings = 0;
+	for (i = 0 ; i < sessions[BY_DEVICE].size ; i++)
+		for (session = sessions[BY_DEVICE].buckets[i] ; session ; session = session->next[BY_DEVICE])
+			for (index = 0 ; session != excluded && index < SESSION_INDEXES ; index++)
+				strings += strlen(session->keys[index]) + 1;
+	for (size = SESSIONS_BUCKETS_MIN ; size < count ; size *= 2);
+
+	snap = malloc(sizeof *snap + count * sizeof *entry + SESSION_INDEXES * size * sizeof(uint32_t) + strings);
+	if (!snap)
+		return NULL;
+	snap->retired = NULL;
+	snap->epoch = 0;
+	snap->count = count;
+	snap->size = size;
+	for (index = 0 ; index < SESSION_INDEXES ; index++)
+		snap->buckets[index] = (uint32_t*)&snap->entries[count] + index * size;
+	memset(snap->buckets[0], 0, SESSION_INDEXES * size * sizeof(uint32_t));
+	p = (char*)(snap->buckets[0] + SESSION_INDEXES * size);
+
+	n = 0;
+	for (i = 0 ; i < sessions[BY_DEVICE].size ; i++)
+	{
+		for (session = sessions[BY_DEVICE].buckets[i] ; session ; session = session->next[BY_DEVICE])
+		{
+			if (session == excluded)
+				continue;
+			entry = &snap->entries[n++];
+			for (index = 0 ; index < SESSION_INDEXES ; index++)
+			{
+				length = strlen(session->keys[index]) + 1;
+				entry->keys[index] = memcpy(p, session->keys[index], length);
+				p += length;
+				h = hash_string(entry->keys[index]) & (size - 1);
+				entry->next[index] = snap->buckets[index][h];
+				snap->buckets[index][h] = n;
+			}
+		}
+	}
+	return snap;
+}
+
+/**
+ * @brief Find an entry of a snapshot by key.
+ * @param[in] snap The snapshot, may be NULL.
+ * @param[in] index The index to search.
+ * @param[in] key The device, user or seat.
+ * @return The first entry matching, NULL if none.
+ */
+static const struct snapshot_entry* snapshot_find(const struct snapshot* snap, enum session_index index, const char* key)
+{
+	uint32_t n;
+
+	if (!snap)
+		return NULL;
+	for (n = snap->buckets[index][hash_string(key) & (snap->size - 1)] ; n ; n = snap->entries[n - 1].next[index])
+		if (!strcmp(snap->entries[n - 1].keys[index], key))
+			return &snap->entries[n - 1];
+	return NULL;
+}
+
+/**
+ * @brief Describe an entry of a snapshot.
+ * @param[in] entry The entry.
+ * @return A json object with the device, the user and the seat.
+ */
+static struct json_object* snapshot_entry_to_json(const struct snapshot_entry* entry)
+{
+	struct json_object* result = json_object_new_object();
+
+	json_object_object_add(result, "device", json_object_new_string(entry->keys[BY_DEVICE]));
+	json_object_object_add(result, "user", json_object_new_string(entry->keys[BY_USER]));
+	json_object_object_add(result, "seat", json_object_new_string(entry->keys[BY_SEAT]));
+	return result;
+}
+
+/**
+ * @brief Free the retired snapshots that no reader can still use.
+ */
+static void snapshot_reclaim()
+{
+	struct snapshot_reader* reader;
+	struct snapshot** prv;
+	struct snapshot* snap;
+	unsigned long long oldest, epoch;
+
+	oldest = ~0ULL;
+	for (reader = __atomic_load_n(&snapshot_readers, __ATOMIC_ACQUIRE) ; reader ; reader = reader->next)
+	{
+		epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+		if (epoch && epoch < oldest)
+			oldest = epoch;
+	}
+
+	prv = &snapshots_retired;
+	while ((snap = *prv))
+	{
+		if (snap->epoch < oldest)
+		{
+			*prv = snap->retired;
+			free(snap);
+		}
+		else
+			prv = &snap->retired;
+	}
+}
+
+/**
+ * @brief Publish a snapshot of the sessions, built before changing them
+ * so that a change that can't be published is refused.
+ * @param[in] snap The snapshot.
+ */
+static void snapshot_publish(struct snapshot* snap)
+{
+	snap = __atomic_exchange_n(&snapshot, snap, __ATOMIC_SEQ_CST);
+	if (snap)
+	{
+		/* the readers of this epoch or older may use it */
+		snap->epoch = __atomic_load_n(&snapshot_epoch, __ATOMIC_SEQ_CST);
+		snap->retired = snapshots_retired;
+		snapshots_retired = snap;
+	}
+	__atomic_add_fetch(&snapshot_epoch, 1, __ATOMIC_SEQ_CST);
+	snapshot_reclaim();
+}
+
+/**
+ * @brief Release the reader slot of an exiting thread.
+ * @param[in] arg The slot.
+ */
+static void snapshot_reader_release(void* arg)
+{
+	struct snapshot_reader* reader = arg;
+
+	pthread_mutex_lock(&snapshot_readers_mutex);
+	reader->owned = 0;
+	pthread_mutex_unlock(&snapshot_readers_mutex);
+}
+
+static void snapshot_reader_key_create()
+{
+	pthread_key_create(&snapshot_reader_key, snapshot_reader_release);
+}
+
+/**
+ * @brief Start reading the published snapshot. The first read of a
+ * thread takes a reader slot, the next ones don't lock.
+ * @return The snapshot, NULL if there is none or out of memory.
+ */
+static const struct snapshot* snapshot_enter()
+{
+	struct snapshot_reader* reader;
+
+	reader = snapshot_reader;
+	if (!reader)
+	{
+		pthread_once(&snapshot_readers_once, snapshot_reader_key_create);
+		pthread_mutex_lock(&snapshot_readers_mutex);
+		for (reader = snapshot_readers ; reader && reader->owned ; reader = reader->next);
+		if (!reader)
+		{
+			reader = calloc(1, sizeof *reader);
+			if (reader)
+			{
+				reader->next = snapshot_readers;
+				__atomic_store_n(&snapshot_readers, reader, __ATOMIC_RELEASE);
+			}
+		}
+		if (reader)
+			reader->owned = 1;
+		pthread_mutex_unlock(&snapshot_readers_mutex);
+		if (!reader)
+			return NULL;
+		pthread_setspecific(snapshot_reader_key, reader);
+		snapshot_reader = reader;
+	}
+
+	__atomic_store_n(&reader->epoch, __atomic_load_n(&snapshot_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&snapshot, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Stop reading the snapshot given by snapshot_enter.
+ */
+static void snapshot_leave()
+{
+	if (snapshot_reader)
+		__atomic_store_n(&snapshot_reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
 /**
  * @brief PAM authentication process.
  * @param[in] pamh The handle to the PAM context.
  * @param[in] device The device to login.
+ * @param[in] seat The seat of the device.
+ * @param[out] user The user authenticated, to be freed.
  */
-static int pam_process(pam_handle_t* pamh, const char* device)
+static int pam_process(pam_handle_t* pamh, const char* device, const char* seat, char** user)
 {
 	int r;
 	
 	if (!pamh) return LOGIN_ERROR_PAM_START;
 	
 	char pam_variable[4096] = "DEVICE=";
-	strcat(pam_variable, device);
+	strncat(pam_variable, device, sizeof pam_variable - sizeof "DEVICE=");
 	
+	if ((r = pam_putenv(pamh, pam_variable)) != PAM_SUCCESS)
+		return LOGIN_ERROR_PAM_PUTENV;
+
+	snprintf(pam_variable, sizeof pam_variable, "SEAT=%s", seat);
 	if ((r = pam_putenv(pamh, pam_variable)) != PAM_SUCCESS)
 		return LOGIN_ERROR_PAM_PUTENV;
 
@@ -148,8 +664,7 @@ static int pam_process(pam_handle_t* pamh, const char* device)
 	if (!pam_user)
 		return LOGIN_ERROR_PAM_NO_USER;
 
-	current_device = strdup(device);
-	current_user = strdup(pam_user);
+	*user = strdup(pam_user);
 	
 	return LOGIN_SUCCESS;
 }
@@ -157,20 +672,20 @@ static int pam_process(pam_handle_t* pamh, const char* device)
 /**
  * @brief Login using PAM.
  * @param[in] device The device to use.
+ * @param[in] seat The seat of the device.
+ * @param[out] user The user authenticated, to be freed.
  * @return Exit code, @c LOGIN_SUCCESS on success.
  */
-static int login_pam(const char* device)
+static int login_pam(const char* device, const char* seat, char** user)
 {
 	int r;
 	pam_handle_t* pamh;
 	
-	if (current_user)
-		return LOGIN_ERROR_USER_LOGGED;
-
-	if ((r = pam_start("agl", NULL, &conv, &pamh)) != PAM_SUCCESS)
+	*user = NULL;
+	if ((r = pam_start(PAM_RULE, NULL, &conv, &pamh)) != PAM_SUCCESS)
 		return LOGIN_ERROR_PAM_START;
 
-	r = pam_process(pamh, device);
+	r = pam_process(pamh, device, seat, user);
 	if (r != LOGIN_SUCCESS)
 	{
 		pam_end(pamh, r);
@@ -178,140 +693,459 @@ static int login_pam(const char* device)
 	}
 
 	if ((r = pam_end(pamh, r)) != PAM_SUCCESS)
+	{
+		free(*user);
+		*user = NULL;
 		return LOGIN_ERROR_PAM_END;
+	}
 	
 	return LOGIN_SUCCESS;
 }
 
 /**
- * @brief Try to login a user using a device.
- * @param[in] device The device to use.
+ * @brief Complete the login of a user using a device.
+ * @param[in] device The device used.
+ * @param[in] seat The seat of the device.
+ * @param[in] ret The result of the authentication.
+ * @param[in] user The user authenticated, may be NULL.
  * @return Exit code, @c LOGIN_SUCCESS if success.
  */
-static int login(const char* device)
+static int login(const char* device, const char* seat, int ret, const char* user)
 {
-	int ret;
+	struct session* session;
+	struct snapshot* snap;
 	struct json_object* result;
 	
-	result = json_object_new_object();
-	
-	ret = login_pam(device);
-	switch(ret)
+	/* an earlier plug may have logged in meanwhile */
+	if (ret == LOGIN_SUCCESS && (session_find(BY_SEAT, seat) || session_find(BY_DEVICE, device)))
+		ret = LOGIN_ERROR_USER_LOGGED;
+
+	if (ret == LOGIN_SUCCESS)
 	{
-		case LOGIN_SUCCESS:
-			json_object_object_add(result, "device", json_object_new_string(current_device));
-			json_object_object_add(result, "user", json_object_new_string(current_user));
+		session = user ? session_add(device, user, seat) : NULL;
+		snap = session ? snapshot_build(NULL) : NULL;
+		if (!snap && session)
+			session_remove(session);
+		if (snap)
+		{
+			snapshot_publish(snap);
+			result = session_to_json(session);
+			AFB_INFO("[login] device: %s, seat: %s", device, seat);
 			afb_event_broadcast(evt_login, result);
-			break;
-		default:
-			json_object_object_add(result, "message", json_object_new_string(error_messages[ret]));
-			afb_event_broadcast(evt_failed, result);
+			return LOGIN_SUCCESS;
+		}
+		ret = LOGIN_ERROR_OUT_OF_MEMORY;
 	}
-	
-	json_object_put(result);
+
+	result = json_object_new_object();
+	json_object_object_add(result, "device", json_object_new_string(device));
+	json_object_object_add(result, "seat", json_object_new_string(seat));
+	json_object_object_add(result, "message", json_object_new_string(error_messages[ret]));
+	afb_event_broadcast(evt_failed, result);
 	return ret;
 }
 
+/**
+ * @brief Free an authentication.
+ * @param[in] auth The authentication.
+ */
+static void auth_free(struct auth* auth)
+{
+	free(auth->user);
+	free(auth->device);
+	free(auth->seat);
+	free(auth);
+}
+
+/**
+ * @brief Queue the authentication of a plugged device to the workers.
+ * A pending authentication of the same device is canceled.
+ * @param[in] device The device to use.
+ * @param[in] seat The seat of the device.
+ */
+static void auth_queue(const char* device, const char* seat)
+{
+	struct auth* auth;
+	struct auth* pending;
+
+	if (session_find(BY_SEAT, seat) || session_find(BY_DEVICE, device))
+	{
+		login(device, seat, LOGIN_ERROR_USER_LOGGED, NULL);
+		return;
+	}
+
+	auth = calloc(1, sizeof *auth);
+	if (auth)
+	{
+		auth->device = strdup(device);
+		auth->seat = strdup(seat);
+	}
+	if (!auth || !auth->device || !auth->seat)
+	{
+		if (auth)
+			auth_free(auth);
+		login(device, seat, LOGIN_ERROR_OUT_OF_MEMORY, NULL);
+		return;
+	}
+
+	pthread_mutex_lock(&auths_mutex);
+	for (pending = auths ; pending ; pending = pending->next)
+		if (!pending->canceled && !strcmp(pending->device, device))
+			pending->canceled = 1;
+	auth->state = AUTH_QUEUED;
+	*auths_tail = auth;
+	auths_tail = &auth->next;
+	pthread_cond_signal(&auths_cond);
+	pthread_mutex_unlock(&auths_mutex);
+}
+
+/**
+ * @brief Cancel the pending authentication of an unplugged device.
+ * @param[in] device The device.
+ * @return 1 if an authentication was canceled, 0 if none was pending.
+ */
+static int auth_cancel(const char* device)
+{
+	struct auth* auth;
+	int canceled = 0;
+
+	pthread_mutex_lock(&auths_mutex);
+	for (auth = auths ; auth ; auth = auth->next)
+	{
+		if (!auth->canceled && !strcmp(auth->device, device))
+		{
+			auth->canceled = 1;
+			canceled = 1;
+		}
+	}
+	pthread_mutex_unlock(&auths_mutex);
+	return canceled;
+}
+
+/**
+ * @brief Wake up the event loop to deliver the results.
+ */
+static void auth_wakeup()
+{
+	uint64_t one = 1;
+
+	if (write(auths_fd, &one, sizeof one) < 0)
+		AFB_ERROR("Can't wake up the event loop");
+}
+
+/**
+ * @brief Main of the workers: authenticate the queued devices.
+ * @param[in] arg Unused.
+ * @return Never returns.
+ */
+static void* auth_worker(void* arg)
+{
+	struct auth* auth;
+
+	pthread_mutex_lock(&auths_mutex);
+	for (;;)
+	{
+		for (auth = auths ; auth && (auth->state != AUTH_QUEUED || auth->canceled) ; auth = auth->next);
+		if (!auth)
+		{
+			pthread_cond_wait(&auths_cond, &auths_mutex);
+			continue;
+		}
+		auth->state = AUTH_RUNNING;
+		pthread_mutex_unlock(&auths_mutex);
+
+		/* the device and the seat don't change while running */
+		auth->ret = login_pam(auth->device, auth->seat, &auth->user);
+
+		pthread_mutex_lock(&auths_mutex);
+		auth->state = AUTH_DONE;
+		auth_wakeup();
+	}
+	return NULL;
+}
+
+/**
+ * @brief Handler of the results of the workers in the binder's event loop.
+ * The results are delivered in the order of the plugs: up to the first
+ * authentication still running or queued.
+ * @param[in] source The event source.
+ * @param[in] fd The eventfd.
+ * @param[in] revents The epoll's events.
+ * @param[in] userdata Unused.
+ * @return Always 0 to keep the source.
+ */
+static int auth_handler(sd_event_source* source, int fd, uint32_t revents, void* userdata)
+{
+	struct auth* done;
+	struct auth** tail;
+	struct auth* auth;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0)
+		AFB_DEBUG("Nothing to read from the workers");
+
+	done = NULL;
+	tail = &done;
+	pthread_mutex_lock(&auths_mutex);
+	while ((auth = auths) && (auth->state == AUTH_DONE || (auth->state == AUTH_QUEUED && auth->canceled)))
+	{
+		auths = auth->next;
+		*tail = auth;
+		tail = &auth->next;
+	}
+	*tail = NULL;
+	if (!auths)
+		auths_tail = &auths;
+	pthread_mutex_unlock(&auths_mutex);
+
+	while ((auth = done))
+	{
+		done = auth->next;
+		login(auth->device, auth->seat, auth->canceled ? LOGIN_ERROR_CANCELED : auth->ret, auth->user);
+		auth_free(auth);
+	}
+	return 0;
+}
+
 /// @brief Try to logout a user using a device.
 /// @param[in] device The device to logout.
 static void logout(const char* device)
 {
+	struct session* session;
+	struct snapshot* snap;
 	struct json_object* result;
 	
-	result = json_object_new_object();
-	
-	if (current_device && !strcmp(device, current_device))
+	session = session_find(BY_DEVICE, device);
+	snap = session ? snapshot_build(session) : NULL;
+	if (snap)
 	{
-		json_object_object_add(result, "device", json_object_new_string(current_device));
-		json_object_object_add(result, "user", json_object_new_string(current_user));
+		result = session_to_json(session);
+		session_remove(session);
+		snapshot_publish(snap);
 		AFB_INFO("[logout] device: %s", device);
-		afb_event_broadcast(evt_logout, NULL);
-		
-		free_string(&current_device);
-		free_string(&current_user);
+		afb_event_broadcast(evt_logout, result);
+	}
+	else if (session)
+	{
+		/* the user stays logged in, as the published sessions say */
+		result = session_to_json(session);
+		json_object_object_add(result, "message", json_object_new_string(error_messages[LOGIN_ERROR_OUT_OF_MEMORY]));
+		AFB_ERROR("Can't logout the device %s: out of memory", device);
+		afb_event_broadcast(evt_failed, result);
 	}
 	else
 	{
-		json_object_object_add(result, "message", json_object_new_string("The unplugged device wasn't the user key!"));
-		AFB_INFO("The unplugged device wasn't the user key!");
+		result = json_object_new_object();
+		json_object_object_add(result, "device", json_object_new_string(device));
+		json_object_object_add(result, "message", json_object_new_string("The unplugged device wasn't a user key!"));
+		AFB_INFO("The unplugged device wasn't a user key!");
 		afb_event_broadcast(evt_failed, result);
 	}
-	json_object_put(result);
 }
 
 /**
- * @brief UDev's monitoring thread.
+ * @brief Check the properties of a device against the patterns.
+ * @param[in] dev The device.
+ * @return 1 if all the patterns match, 0 otherwise.
  */
-void* udev_monitoring_thread(void* arg)
+static int udev_device_matches(struct udev_device* dev)
 {
-	struct udev_device* dev;
-	struct pollfd pfd;
-	int action;
-	
-	pfd.fd = udev_monitor_get_fd(udev_mon);
-	pfd.events = POLLIN;
-	
-	while(1)
+	const char* value;
+	size_t i;
+
+	for (i = 0 ; i < sizeof udev_matches / sizeof *udev_matches ; i++)
 	{
-		if (poll(&pfd, 1, UDEV_MONITOR_POLLING_TIMEOUT))
+		if (udev_matches[i].pattern)
 		{
-			dev = udev_monitor_receive_device(udev_mon);
-			if (dev)
-			{
-				if (!strcmp(udev_device_get_devtype(dev), "disk"))
-				{
-					action = udev_device_get_action_int(dev);
-					switch(action)
-					{
-						case UDEV_ACTION_ADD:
-							AFB_INFO("A device is plugged-in");
-							print_udev_device_info(dev);
-							login(udev_device_get_devnode(dev));
-							break;
-						case UDEV_ACTION_REMOVE:
-							AFB_INFO("A device is plugged-out");
-							print_udev_device_info(dev);
-							logout(udev_device_get_devnode(dev));
-							break;
-						default:
-							AFB_DEBUG("Unsupported udev action");
-							break;
-					}
-				}
-				udev_device_unref(dev);
-			}
-			else
-			{
-				AFB_ERROR("No Device from udev_monitor_receive_device().");
-			}
-		}
-		else
-		{
-			AFB_DEBUG("Udev polling timeout");
+			value = udev_device_get_property_value(dev, udev_matches[i].property);
+			if (!value || fnmatch(udev_matches[i].pattern, value, 0))
+				return 0;
 		}
 	}
-	return NULL;
+	return 1;
+}
+
+/**
+ * @brief Handle a device event received from udev.
+ * @param[in] dev The device.
+ */
+static void udev_handle_device(struct udev_device* dev)
+{
+	const char* devtype = udev_device_get_devtype(dev);
+	const char* seat;
+
+	__atomic_add_fetch(&udev_delivered, 1, __ATOMIC_RELAXED);
+	if (!devtype || strcmp(devtype, "disk") || !udev_device_matches(dev))
+	{
+		__atomic_add_fetch(&udev_filtered, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	switch(udev_device_get_action_int(dev))
+	{
+		case UDEV_ACTION_ADD:
+			AFB_INFO("A device is plugged-in");
+			print_udev_device_info(dev);
+			seat = udev_device_get_property_value(dev, "ID_SEAT");
+			auth_queue(udev_device_get_devnode(dev), seat && *seat ? seat : SEAT_DEFAULT);
+			break;
+		case UDEV_ACTION_REMOVE:
+			AFB_INFO("A device is plugged-out");
+			print_udev_device_info(dev);
+			if (auth_cancel(udev_device_get_devnode(dev)))
+				auth_wakeup();
+			else
+				logout(udev_device_get_devnode(dev));
+			break;
+		default:
+			AFB_DEBUG("Unsupported udev action");
+			break;
+	}
+}
+
+/**
+ * @brief Handler of the udev's monitor in the binder's event loop.
+ * The monitor is non-blocking: all the pending devices are received.
+ * An error of the netlink socket is an overrun of its receive buffer,
+ * some events are lost: it is logged and the next receive clears it.
+ * The source is only disabled when the socket is hung up.
+ * @param[in] source The event source.
+ * @param[in] fd The monitor's file descriptor.
+ * @param[in] revents The epoll's events.
+ * @param[in] userdata Unused.
+ * @return Always 0.
+ */
+static int udev_monitor_handler(sd_event_source* source, int fd, uint32_t revents, void* userdata)
+{
+	struct udev_device* dev;
+
+	if (revents & EPOLLHUP)
+	{
+		AFB_ERROR("The udev's monitor is hung up, the devices are no longer watched");
+		sd_event_source_set_enabled(source, SD_EVENT_OFF);
+		return 0;
+	}
+	if (revents & EPOLLERR)
+		AFB_ERROR("Overrun of the udev's monitor, events of devices are lost");
+
+	while ((dev = udev_monitor_receive_device(udev_mon)))
+	{
+		udev_handle_device(dev);
+		udev_device_unref(dev);
+	}
+	return 0;
 }
 
 /**
  * @brief API's verb 'getuser'. Try to get user informations.
+ * The session is the one of the argument 'device' or else of the
+ * argument 'seat', by default the seat "seat0".
  * @param[in] req The request object.
  */
 static void verb_getuser(struct afb_req req)
 {
-	if (!current_device || !current_user)
+	const char* device;
+	const char* seat;
+	const struct snapshot* snap;
+	const struct snapshot_entry* entry;
+	struct json_object* result;
+
+	device = afb_req_value(req, "device");
+	seat = afb_req_value(req, "seat");
+
+	snap = snapshot_enter();
+	if (device)
+		entry = snapshot_find(snap, BY_DEVICE, device);
+	else
+		entry = snapshot_find(snap, BY_SEAT, seat ? seat : SEAT_DEFAULT);
+	result = entry ? snapshot_entry_to_json(entry) : NULL;
+	snapshot_leave();
+
+	if (!result)
 	{
 		afb_req_fail(req, "there is no logged user!", NULL);
 		return;
 	}
+	afb_req_success(req, result, NULL);
+}
+
+/**
+ * @brief API's verb 'listsessions'. List the sessions, all or those of the argument 'user'.
+ * @param[in] req The request object.
+ */
+static void verb_listsessions(struct afb_req req)
+{
+	const char* user;
+	size_t i;
+	uint32_t n;
+	const struct snapshot* snap;
+	const struct snapshot_entry* entry;
+	struct json_object* result;
+
+	user = afb_req_value(req, "user");
+	result = json_object_new_array();
 
-	json_object* result = json_object_new_object();
-	json_object_object_add(result, "user", json_object_new_string(current_user));
-	json_object_object_add(result, "device", json_object_new_string(current_device));
+	snap = snapshot_enter();
+	if (user)
+	{
+		entry = snapshot_find(snap, BY_USER, user);
+		for (n = entry ? (uint32_t)(entry - snap->entries) + 1 : 0 ; n ; n = snap->entries[n - 1].next[BY_USER])
+			if (!strcmp(snap->entries[n - 1].keys[BY_USER], user))
+				json_object_array_add(result, snapshot_entry_to_json(&snap->entries[n - 1]));
+	}
+	else if (snap)
+	{
+		for (i = 0 ; i < snap->count ; i++)
+			json_object_array_add(result, snapshot_entry_to_json(&snap->entries[i]));
+	}
+	snapshot_leave();
 
 	afb_req_success(req, result, NULL);
 }
 
+/**
+ * @brief API's verb 'stats'. Count the udev's events delivered to the
+ * binding and those of them filtered out in user space.
+ * @param[in] req The request object.
+ */
+static void verb_stats(struct afb_req req)
+{
+	struct json_object* result = json_object_new_object();
+
+	json_object_object_add(result, "delivered", json_object_new_int64((int64_t)__atomic_load_n(&udev_delivered, __ATOMIC_RELAXED)));
+	json_object_object_add(result, "filtered", json_object_new_int64((int64_t)__atomic_load_n(&udev_filtered, __ATOMIC_RELAXED)));
+	afb_req_success(req, result, NULL);
+}
+
+/**
+ * @brief Set the filters of the udev's monitor: in the kernel, the
+ * disks and, if the environment variable LL_AUTH_TAG is set, its tag;
+ * in user space, the patterns of the properties.
+ * @return 0 on success, -1 on error.
+ */
+static int udev_set_filters()
+{
+	const char* tag;
+	size_t i;
+
+	if (udev_monitor_filter_add_match_subsystem_devtype(udev_mon, "block", "disk") < 0)
+		return -1;
+
+	tag = secure_getenv("LL_AUTH_TAG");
+	if (tag && *tag && udev_monitor_filter_add_match_tag(udev_mon, tag) < 0)
+		return -1;
+
+	for (i = 0 ; i < sizeof udev_matches / sizeof *udev_matches ; i++)
+	{
+		udev_matches[i].pattern = secure_getenv(udev_matches[i].variable);
+		if (udev_matches[i].pattern && !*udev_matches[i].pattern)
+			udev_matches[i].pattern = NULL;
+		if (udev_matches[i].pattern)
+			AFB_INFO("Only the devices whose %s matches %s", udev_matches[i].property, udev_matches[i].pattern);
+	}
+	return 0;
+}
+
 /**
  * @brief Do the cleanup when init fails.
  * @param[in] error Error message.
@@ -321,14 +1155,52 @@ static void verb_getuser(struct afb_req req)
 static inline int ll_auth_init_cleanup(const char* error, int retcode)
 {
 	AFB_ERROR("%s", error);
-	free_string(&current_user);
-	free_string(&current_device);
-	
+	free_event_source(&auths_source);
+	if (auths_fd >= 0)
+	{
+		close(auths_fd);
+		auths_fd = -1;
+	}
+	free_event_source(&udev_source);
 	free_udev_monitor(&udev_mon);
 	free_udev_context(&udev_context);
 	return retcode;
 }
 
+/**
+ * @brief Start the workers of the authentications. Their count is read
+ * from the environment variable LL_AUTH_WORKERS, 1 to AUTH_WORKERS_MAX.
+ * @return The count of workers started.
+ */
+static int auth_start_workers()
+{
+	const char* value;
+	char* end;
+	long count;
+	int started;
+	pthread_t thread;
+
+	count = AUTH_WORKERS_DEFAULT;
+	value = secure_getenv("LL_AUTH_WORKERS");
+	if (value)
+	{
+		count = strtol(value, &end, 10);
+		if (*end || count < 1 || count > AUTH_WORKERS_MAX)
+		{
+			AFB_ERROR("Invalid LL_AUTH_WORKERS %s, using %d", value, AUTH_WORKERS_DEFAULT);
+			count = AUTH_WORKERS_DEFAULT;
+		}
+	}
+
+	for (started = 0 ; started < count ; started++)
+	{
+		if (pthread_create(&thread, NULL, auth_worker, NULL))
+			break;
+		pthread_detach(thread);
+	}
+	return started;
+}
+
 /**
  * @brief Initialize the binding.
  */
@@ -341,6 +1213,13 @@ int ll_auth_init()
 	if (!afb_event_is_valid(evt_login) || !afb_event_is_valid(evt_logout) || !afb_event_is_valid(evt_failed))
 		return ll_auth_init_cleanup("Can't create events", -1);
 		
+	auths_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (auths_fd < 0)
+		return ll_auth_init_cleanup("Can't create the eventfd of the workers", -1);
+
+	if (sd_event_add_io(afb_daemon_get_event_loop(), &auths_source, auths_fd, EPOLLIN, auth_handler, NULL) < 0)
+		return ll_auth_init_cleanup("Can't watch the workers in the event loop", -1);
+
 	udev_context = udev_new();
 	if (!udev_context)
 		return ll_auth_init_cleanup("Can't initialize udev's context", -1);
@@ -349,11 +1228,21 @@ int ll_auth_init()
 	if (!udev_mon)
 		return ll_auth_init_cleanup("Can't initialize udev's monitor", -1);
 	
-	udev_monitor_filter_add_match_subsystem_devtype(udev_mon, "block", NULL);
-	udev_monitor_enable_receiving(udev_mon);
+	if (udev_set_filters() < 0)
+		return ll_auth_init_cleanup("Can't set the filters of udev's monitor", -1);
+	
+	if (udev_monitor_set_receive_buffer_size(udev_mon, UDEV_RECEIVE_BUFFER_SIZE) < 0)
+		AFB_WARNING("Can't enlarge the receive buffer of udev's monitor");
+
+	if (udev_monitor_enable_receiving(udev_mon) < 0)
+		return ll_auth_init_cleanup("Can't enable udev's monitor", -1);
+	
+	if (sd_event_add_io(afb_daemon_get_event_loop(), &udev_source, udev_monitor_get_fd(udev_mon),
+			EPOLLIN, udev_monitor_handler, NULL) < 0)
+		return ll_auth_init_cleanup("Can't watch udev's monitor in the event loop", -1);
 	
-	if (pthread_create(&udev_monitoring_thread_handle, NULL, udev_monitoring_thread, NULL))
-		return ll_auth_init_cleanup("Can't start the udev's monitoring thread", -1);
+	if (!auth_start_workers())
+		return ll_auth_init_cleanup("Can't start the workers of the authentications", -1);
 	
 	AFB_INFO("ll-auth-binding is ready");
 	return 0;
@@ -367,6 +1256,20 @@ static const afb_verb_v2 _ll_auth_binding_verbs[]= {
 		.info = NULL,
 		.session = AFB_SESSION_NONE_V2
 	},
+	{
+		.verb = "listsessions",
+		.callback = verb_listsessions,
+		.auth = NULL,
+		.info = NULL,
+		.session = AFB_SESSION_NONE_V2
+	},
+	{
+		.verb = "stats",
+		.callback = verb_stats,
+		.auth = NULL,
+		.info = NULL,
+		.session = AFB_SESSION_NONE_V2
+	},
 	{ .verb=NULL}
 };
 
@@ -0,0 +1,682 @@
+/*
+ * Replay of plugs and unplugs of devices against the authentications.
+ *
+ * The binding is built in this program with the binder, udev's devices
+ * and PAM replaced: the devices are given to udev_handle_device as the
+ * monitor does, PAM accepts or rejects each device after a random delay
+ * in the workers, and the event loop is this thread, which delivers the
+ * results at random times. Bursts of plugs and unplugs of several
+ * devices, some sharing a seat, are replayed and every event broadcast
+ * is checked against a model: the results of the authentications come
+ * in the order of the plugs, a device unplugged before its result is
+ * canceled, and after each burst each device has the session expected.
+ * Meanwhile reader threads look the devices up in the published
+ * snapshots, as the verbs do, so that a snapshot freed while read shows
+ * up under AddressSanitizer and a torn one as an inconsistent entry.
+ */
+#include "ll-auth-binding.c"
+
+#include <poll.h>
+#include <time.h>
+
+#define EXIT_CMDLINE												1
+#define EXIT_SETUP													2
+#define EXIT_ALLOC													3
+#define EXIT_CHECK													4
+
+#define DEVICES_MAX													64
+#define BURST_MAX													3
+#define DRAIN_TIMEOUT_MS											10000
+#define REPORT_MAX													10
+#define READERS_MAX													16
+
+/**
+ * A device of the replay: plugged or not, and logged in or not once its
+ * results are delivered. The devices whose index modulo 4 is 3 are
+ * rejected by PAM.
+ */
+struct device
+{
+	char node[32];
+	char seat[16];
+	char user[16];
+	int rejected;
+	int plugged;
+	int logged;
+};
+
+/**
+ * A plug of a device whose result wasn't delivered yet, in the order
+ * of the plugs.
+ */
+struct plug
+{
+	struct plug* next;
+	struct device* device;
+	int canceled;
+};
+
+/**
+ * A thread reading the snapshots.
+ */
+struct reader
+{
+	pthread_t thread;
+	unsigned long long reads;
+	unsigned errors;
+};
+
+/**
+ * An event broadcast by the binding.
+ */
+struct result
+{
+	const char* event;
+	char device[32];
+	char user[16];
+	char seat[16];
+	char message[128];
+};
+
+static unsigned					device_count						= 8;
+static unsigned					seat_count							= 4;
+static unsigned					round_count							= 200;
+static unsigned					delay_max							= 2000;
+static unsigned					seed								= 1;
+static unsigned					reader_count						= 2;
+
+static struct device			devices[DEVICES_MAX];
+static struct plug*				plugs								= NULL;
+static struct plug**			plugs_tail							= &plugs;
+static struct result*			results								= NULL;
+static size_t					results_count						= 0;
+static size_t					results_size						= 0;
+static unsigned					failures							= 0;
+static struct reader			readers[READERS_MAX];
+static int						readers_stop						= 0;
+
+/**
+ * @brief Record a failure and print the first ones.
+ */
+static void failed(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void failed(const char* format, ...)
+{
+	va_list args;
+
+	if (failures++ < REPORT_MAX)
+	{
+		va_start(args, format);
+		vfprintf(stderr, format, args);
+		va_end(args);
+		fputc('\n', stderr);
+	}
+}
+
+/**
+ * @brief Find the device of a node.
+ * @param[in] node The node.
+ * @return The device or NULL.
+ */
+static struct device* device_find(const char* node)
+{
+	unsigned i;
+
+	for (i = 0 ; i < device_count ; i++)
+		if (!strcmp(devices[i].node, node))
+			return &devices[i];
+	return NULL;
+}
+
+/* ---- PAM: accept or reject the device after a random delay ---- */
+
+struct pam_handle
+{
+	char user[16];
+	struct device* device;
+};
+
+int pam_start(const char* service_name, const char* user, const struct pam_conv* pam_conversation, pam_handle_t** pamh)
+{
+	*pamh = calloc(1, sizeof **pamh);
+	return *pamh ? PAM_SUCCESS : PAM_BUF_ERR;
+}
+
+int pam_end(pam_handle_t* pamh, int pam_status)
+{
+	free(pamh);
+	return PAM_SUCCESS;
+}
+
+int pam_putenv(pam_handle_t* pamh, const char* name_value)
+{
+	if (!strncmp(name_value, "DEVICE=", 7))
+		pamh->device = device_find(&name_value[7]);
+	return PAM_SUCCESS;
+}
+
+int pam_authenticate(pam_handle_t* pamh, int flags)
+{
+	static __thread unsigned delay_seed;
+
+	if (!delay_seed)
+		delay_seed = (unsigned)(uintptr_t)&delay_seed ^ (unsigned)time(NULL);
+	if (delay_max)
+		usleep((useconds_t)(rand_r(&delay_seed) % delay_max));
+	if (!pamh->device || pamh->device->rejected)
+		return PAM_AUTH_ERR;
+	strcpy(pamh->user, pamh->device->user);
+	return PAM_SUCCESS;
+}
+
+int pam_acct_mgmt(pam_handle_t* pamh, int flags)
+{
+	return PAM_SUCCESS;
+}
+
+int pam_get_item(const pam_handle_t* pamh, int item_type, const void** item)
+{
+	*item = item_type == PAM_USER && *pamh->user ? pamh->user : NULL;
+	return PAM_SUCCESS;
+}
+
+int misc_conv(int num_msg, const struct pam_message** msgm, struct pam_response** response, void* appdata_ptr)
+{
+	return PAM_CONV_ERR;
+}
+
+/* ---- udev: the devices given to udev_handle_device ---- */
+
+struct udev_device
+{
+	const char* action;
+	struct device* device;
+};
+
+const char* udev_device_get_action(struct udev_device* dev) { return dev->action; }
+const char* udev_device_get_devnode(struct udev_device* dev) { return dev->device->node; }
+const char* udev_device_get_subsystem(struct udev_device* dev) { return "block"; }
+const char* udev_device_get_devtype(struct udev_device* dev) { return "disk"; }
+dev_t udev_device_get_devnum(struct udev_device* dev) { return 0; }
+const char* udev_device_get_devpath(struct udev_device* dev) { return dev->device->node; }
+const char* udev_device_get_driver(struct udev_device* dev) { return ""; }
+unsigned long long udev_device_get_seqnum(struct udev_device* dev) { return 0; }
+const char* udev_device_get_sysname(struct udev_device* dev) { return dev->device->node; }
+const char* udev_device_get_sysnum(struct udev_device* dev) { return ""; }
+const char* udev_device_get_syspath(struct udev_device* dev) { return dev->device->node; }
+
+const char* udev_device_get_property_value(struct udev_device* dev, const char* key)
+{
+	return strcmp(key, "ID_SEAT") ? NULL : dev->device->seat;
+}
+
+/* ---- binder: the events are recorded, the logs printed ---- */
+
+static void copy_member(struct json_object* object, const char* name, char* buffer, size_t size)
+{
+	struct json_object* value;
+
+	*buffer = 0;
+	if (json_object_object_get_ex(object, name, &value))
+		snprintf(buffer, size, "%s", json_object_get_string(value));
+}
+
+static int event_broadcast(void* closure, struct json_object* object)
+{
+	struct result* result;
+
+	if (results_count == results_size)
+	{
+		results_size = results_size ? 2 * results_size : 16;
+		results = realloc(results, results_size * sizeof *results);
+		if (!results)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_ALLOC);
+		}
+	}
+	result = &results[results_count++];
+	result->event = closure;
+	copy_member(object, "device", result->device, sizeof result->device);
+	copy_member(object, "user", result->user, sizeof result->user);
+	copy_member(object, "seat", result->seat, sizeof result->seat);
+	copy_member(object, "message", result->message, sizeof result->message);
+	json_object_put(object);
+	return 0;
+}
+
+static const struct afb_event_itf event_itf =
+{
+	.broadcast = event_broadcast
+};
+
+static struct afb_event daemon_event_make(void* closure, const char* name)
+{
+	struct afb_event event = { &event_itf, (void*)name };
+	return event;
+}
+
+static struct sd_event* daemon_get_event_loop(void* closure)
+{
+	return NULL;
+}
+
+static void daemon_vverbose(void* closure, int level, const char* file, int line, const char* func, const char* fmt, va_list args)
+{
+	fprintf(stderr, "<%d> %s: ", level, func);
+	vfprintf(stderr, fmt, args);
+	fputc('\n', stderr);
+}
+
+static const struct afb_daemon_itf daemon_itf =
+{
+	.get_event_loop = daemon_get_event_loop,
+	.event_make = daemon_event_make,
+	.vverbose_v2 = daemon_vverbose
+};
+
+struct afb_binding_data_v2 afbBindingV2data =
+{
+	.verbosity = 0,
+	.daemon = { &daemon_itf, NULL }
+};
+
+/* ---- the model ---- */
+
+/**
+ * @brief Tell if a seat has a session in the model.
+ * @param[in] seat The seat.
+ * @return 1 if a device of the seat is logged in, 0 otherwise.
+ */
+static int seat_logged(const char* seat)
+{
+	unsigned i;
+
+	for (i = 0 ; i < device_count ; i++)
+		if (devices[i].logged && !strcmp(devices[i].seat, seat))
+			return 1;
+	return 0;
+}
+
+/**
+ * @brief Check a result against the event and the message expected.
+ * @param[in] result The result.
+ * @param[in] device The device expected.
+ * @param[in] event The event expected.
+ * @param[in] message The message expected for a failure.
+ */
+static void check_result(const struct result* result, const struct device* device, const char* event, const char* message)
+{
+	if (strcmp(result->device, device->node))
+		failed("%s: result of %s instead", device->node, result->device);
+	else if (strcmp(result->event, event))
+		failed("%s: event %s (%s) instead of %s (%s)", device->node, result->event, result->message, event, message ? message : "");
+	else if (message && strcmp(result->message, message))
+		failed("%s: message '%s' instead of '%s'", device->node, result->message, message);
+	else if (!strcmp(event, "login") && (strcmp(result->user, device->user) || strcmp(result->seat, device->seat)))
+		failed("%s: login of %s on %s instead of %s on %s", device->node, result->user, result->seat, device->user, device->seat);
+}
+
+/**
+ * @brief Check the results of the authentications delivered: each one
+ * must be the one of the first plug not delivered yet.
+ * @param[in] from The index of the first result to check.
+ */
+static void check_delivered(size_t from)
+{
+	struct plug* plug;
+	struct device* device;
+	const struct result* result;
+
+	for ( ; from < results_count ; from++)
+	{
+		result = &results[from];
+		plug = plugs;
+		if (!plug)
+		{
+			failed("%s: result '%s' without plug", result->device, result->event);
+			continue;
+		}
+		plugs = plug->next;
+		if (!plugs)
+			plugs_tail = &plugs;
+
+		device = plug->device;
+		if (plug->canceled)
+			check_result(result, device, "failed", error_messages[LOGIN_ERROR_CANCELED]);
+		else if (device->rejected)
+			check_result(result, device, "failed", error_messages[LOGIN_ERROR_PAM_AUTHENTICATE]);
+		else if (device->logged || seat_logged(device->seat))
+			check_result(result, device, "failed", error_messages[LOGIN_ERROR_USER_LOGGED]);
+		else
+		{
+			check_result(result, device, "login", NULL);
+			device->logged = 1;
+		}
+		free(plug);
+	}
+}
+
+/**
+ * @brief Run the handler of the results as the event loop does when
+ * the eventfd is readable and check the results delivered.
+ * @param[in] timeout The timeout of the wait in ms, 0 to not wait.
+ */
+static void deliver(int timeout)
+{
+	struct pollfd pfd = { auths_fd, POLLIN, 0 };
+
+	results_count = 0;
+	if (poll(&pfd, 1, timeout) > 0)
+		auth_handler(NULL, auths_fd, EPOLLIN, NULL);
+	check_delivered(0);
+}
+
+/**
+ * @brief Plug a device, as udev does, and update the model.
+ * @param[in] device The device.
+ */
+static void plug(struct device* device)
+{
+	struct udev_device dev = { "add", device };
+	struct plug* plug;
+
+	results_count = 0;
+	udev_handle_device(&dev);
+	device->plugged = 1;
+
+	if (device->logged || seat_logged(device->seat))
+	{
+		/* refused at once */
+		if (results_count != 1)
+			failed("%s: %zu results of a plug on a logged seat", device->node, results_count);
+		else
+			check_result(&results[0], device, "failed", error_messages[LOGIN_ERROR_USER_LOGGED]);
+		return;
+	}
+
+	if (results_count)
+		failed("%s: %zu results of a plug", device->node, results_count);
+	for (plug = plugs ; plug ; plug = plug->next)
+		if (plug->device == device)
+			plug->canceled = 1;
+	plug = calloc(1, sizeof *plug);
+	if (!plug)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_ALLOC);
+	}
+	plug->device = device;
+	*plugs_tail = plug;
+	plugs_tail = &plug->next;
+}
+
+/**
+ * @brief Unplug a device, as udev does, and update the model.
+ * @param[in] device The device.
+ */
+static void unplug(struct device* device)
+{
+	struct udev_device dev = { "remove", device };
+	struct plug* plug;
+	int canceled;
+
+	results_count = 0;
+	udev_handle_device(&dev);
+	device->plugged = 0;
+
+	canceled = 0;
+	for (plug = plugs ; plug ; plug = plug->next)
+	{
+		if (plug->device == device && !plug->canceled)
+		{
+			plug->canceled = 1;
+			canceled = 1;
+		}
+	}
+
+	if (canceled)
+	{
+		/* the result comes later, in the order of the plugs */
+		if (results_count)
+			failed("%s: %zu results of the unplug of a pending device", device->node, results_count);
+	}
+	else if (results_count != 1)
+		failed("%s: %zu results of an unplug", device->node, results_count);
+	else if (device->logged)
+	{
+		check_result(&results[0], device, "logout", NULL);
+		device->logged = 0;
+	}
+	else
+		check_result(&results[0], device, "failed", "The unplugged device wasn't a user key!");
+}
+
+/**
+ * @brief Deliver the results until none is pending.
+ * @return 0 if all were delivered, -1 on timeout.
+ */
+static int drain()
+{
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (plugs)
+	{
+		deliver(100);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 > DRAIN_TIMEOUT_MS)
+		{
+			failed("%s: result not delivered", plugs->device->node);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Check the sessions of the binding and its snapshot against the model.
+ */
+static void check_sessions()
+{
+	struct session* session;
+	const struct snapshot* snap;
+	size_t logged;
+	unsigned i;
+
+	logged = 0;
+	for (i = 0 ; i < device_count ; i++)
+	{
+		session = session_find(BY_DEVICE, devices[i].node);
+		if (!session != !devices[i].logged)
+			failed("%s: %s session", devices[i].node, session ? "unexpected" : "missing");
+		else if (session && (strcmp(session->keys[BY_USER], devices[i].user) || strcmp(session->keys[BY_SEAT], devices[i].seat)))
+			failed("%s: session of %s on %s", devices[i].node, session->keys[BY_USER], session->keys[BY_SEAT]);
+		logged += devices[i].logged;
+	}
+
+	snap = snapshot_enter();
+	if (sessions_count != logged || (snap ? snap->count : 0) != logged)
+		failed("%zu sessions and %zu in the snapshot instead of %zu", sessions_count, snap ? snap->count : 0, logged);
+	snapshot_leave();
+}
+
+/**
+ * @brief Look the devices up in the published snapshots until stopped:
+ * each entry found must be the one of its device, whose user and seat
+ * are fixed.
+ * @param[in] arg The reader.
+ * @return NULL.
+ */
+static void* reader_main(void* arg)
+{
+	struct reader* reader = arg;
+	const struct snapshot* snap;
+	const struct snapshot_entry* entry;
+	unsigned i;
+
+	while (!__atomic_load_n(&readers_stop, __ATOMIC_RELAXED))
+	{
+		snap = snapshot_enter();
+		for (i = 0 ; i < device_count ; i++)
+		{
+			entry = snapshot_find(snap, BY_DEVICE, devices[i].node);
+			if (entry && (strcmp(entry->keys[BY_USER], devices[i].user) || strcmp(entry->keys[BY_SEAT], devices[i].seat)))
+				reader->errors++;
+			entry = snapshot_find(snap, BY_SEAT, devices[i].seat);
+			if (entry && strcmp(entry->keys[BY_SEAT], devices[i].seat))
+				reader->errors++;
+		}
+		if (snap && snap->count > device_count)
+			reader->errors++;
+		snapshot_leave();
+		reader->reads++;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Replay a burst: up to BURST_MAX plugs or unplugs of some of
+ * the devices, shuffled, the results being delivered at random times.
+ */
+static void burst()
+{
+	unsigned events[DEVICES_MAX * BURST_MAX];
+	unsigned count, i, j, n, swap;
+	struct device* device;
+
+	count = 0;
+	for (i = 0 ; i < device_count ; i++)
+		if (rand_r(&seed) % 2)
+			for (n = 1 + (unsigned)rand_r(&seed) % BURST_MAX ; n ; n--)
+				events[count++] = i;
+
+	/* any order keeps the order of the events of each device */
+	for (i = count ; i > 1 ; i--)
+	{
+		j = (unsigned)rand_r(&seed) % i;
+		swap = events[i - 1];
+		events[i - 1] = events[j];
+		events[j] = swap;
+	}
+
+	for (i = 0 ; i < count ; i++)
+	{
+		device = &devices[events[i]];
+		if (device->plugged)
+			unplug(device);
+		else
+			plug(device);
+
+		switch (rand_r(&seed) % 8)
+		{
+			case 0:
+			case 1:
+				deliver(0);
+				break;
+			case 2:
+				deliver((int)(rand_r(&seed) % (delay_max / 1000 + 1)));
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d COUNT   count of devices (default 8, at most %d)\n"
+		"  -s COUNT   count of seats shared by the devices (default 4)\n"
+		"  -r COUNT   count of bursts (default 200)\n"
+		"  -w COUNT   count of workers (default LL_AUTH_WORKERS or %d)\n"
+		"  -D USEC    maximum delay of an authentication (default 2000)\n"
+		"  -R COUNT   count of threads reading the snapshots (default 2, at most %d)\n"
+		"  -S SEED    seed of the replay (default 1)\n"
+		"  -v         more logs of the binding\n",
+		name, DEVICES_MAX, AUTH_WORKERS_DEFAULT, READERS_MAX);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned long long reads;
+	unsigned i, errors;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:s:r:w:D:R:S:vh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd': device_count = (unsigned)atoi(optarg); break;
+			case 's': seat_count = (unsigned)atoi(optarg); break;
+			case 'r': round_count = (unsigned)atoi(optarg); break;
+			case 'w': setenv("LL_AUTH_WORKERS", optarg, 1); break;
+			case 'D': delay_max = (unsigned)atoi(optarg); break;
+			case 'R': reader_count = (unsigned)atoi(optarg); break;
+			case 'S': seed = (unsigned)atoi(optarg); break;
+			case 'v': afbBindingV2data.verbosity++; break;
+			default: usage(argv[0]); return EXIT_CMDLINE;
+		}
+	}
+	if (!device_count || device_count > DEVICES_MAX || !seat_count || reader_count > READERS_MAX)
+	{
+		usage(argv[0]);
+		return EXIT_CMDLINE;
+	}
+
+	for (i = 0 ; i < device_count ; i++)
+	{
+		snprintf(devices[i].node, sizeof devices[i].node, "/dev/replay%u", i);
+		snprintf(devices[i].seat, sizeof devices[i].seat, "seat%u", i % seat_count);
+		snprintf(devices[i].user, sizeof devices[i].user, "user%u", i);
+		devices[i].rejected = i % 4 == 3;
+	}
+
+	evt_login = afb_daemon_make_event("login");
+	evt_logout = afb_daemon_make_event("logout");
+	evt_failed = afb_daemon_make_event("failed");
+	auths_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (auths_fd < 0 || !auth_start_workers())
+	{
+		fprintf(stderr, "Can't start the workers\n");
+		return EXIT_SETUP;
+	}
+	for (i = 0 ; i < reader_count ; i++)
+	{
+		if (pthread_create(&readers[i].thread, NULL, reader_main, &readers[i]))
+		{
+			fprintf(stderr, "Can't start the readers\n");
+			return EXIT_SETUP;
+		}
+	}
+
+	for (i = 0 ; i < round_count ; i++)
+	{
+		burst();
+		if (drain())
+			break;
+		check_sessions();
+	}
+
+	/* unplug all, nothing must stay */
+	for (i = 0 ; i < device_count ; i++)
+		if (devices[i].plugged)
+			unplug(&devices[i]);
+	if (!drain())
+		check_sessions();
+
+	__atomic_store_n(&readers_stop, 1, __ATOMIC_RELAXED);
+	reads = 0;
+	errors = 0;
+	for (i = 0 ; i < reader_count ; i++)
+	{
+		pthread_join(readers[i].thread, NULL);
+		reads += readers[i].reads;
+		errors += readers[i].errors;
+	}
+	if (errors)
+		failed("%u inconsistent entries read in the snapshots", errors);
+
+	printf("%u devices on %u seats, %u bursts, %llu snapshot reads: %u failures\n", device_count, seat_count, round_count, reads, failures);
+	return failures ? EXIT_CHECK : EXIT_SUCCESS;
+}
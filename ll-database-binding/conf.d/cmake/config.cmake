@@ -173,6 +173,11 @@ set(WIDGET_ENTRY_POINT irrelevant)
 # -----------------------------------------------------
 # set(PKG_PREFIX DestinationPath)
 
+# Default durability of the writes: sync, group[:DELAY-MS[:WRITES]] or async
+# It can be overridden at run time by the environment variable LL_DATABASE_DURABILITY
+# ------------------------------------------------------------------------------------
+set(DATABASE_DURABILITY "sync" CACHE STRING "Default durability of the database writes")
+
 # Optional Application Framework security token
 # and port use for remote debugging.
 #------------------------------------------------------------
@@ -0,0 +1,498 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(XDB_STANDALONE)
+# define AFB_ERROR(...)  (fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+# define AFB_INFO(...)   (fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+#else
+# define AFB_BINDING_VERSION 2
+# include <afb/afb-binding.h>
+#endif
+
+#include "appids.h"
+
+/*
+ * Dictionary of the application ids. Each application gets a number
+ * at its first request and its records are keyed by that number
+ * followed by the key of the application and a null byte.
+ *
+ * The number is encoded on 1 to 4 bytes, the count of leading 1 bits of
+ * the first byte telling the count of bytes that follow:
+ *   10xxxxxx                            0 .. 2^6-1
+ *   110xxxxx xxxxxxxx                   .. 2^13-1
+ *   1110xxxx xxxxxxxx xxxxxxxx          .. 2^20-1
+ *   1111xxxx xxxxxxxx xxxxxxxx xxxxxxxx .. 2^28-1
+ * This keeps the keys of an application contiguous and in the order of
+ * the keys of the application. As the first byte has its high bit set,
+ * these keys never collide with the records of the dictionary, whose
+ * keys begin with a null byte, nor with the keys "appid:key" of the
+ * databases written before the dictionary, whose first byte is ascii.
+ *
+ * The dictionary is stored in the records "\0appid\0" holding the number
+ * of 'appid' and the record "\0" holding the version of the key format.
+ * A database without the record "\0" is migrated at start.
+ */
+#define NUMBER_LIMIT	(1U << 28)
+#define VERSION		"1"
+#define MIGRATE_BATCH	1024
+
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct appid **apps;	/* the applications by number, or NULL */
+static size_t count;		/* count of numbers given */
+static size_t allocated;	/* allocated count of apps */
+static uint32_t *table;		/* open addressing hash table of number+1 by id, 0 when empty */
+static size_t tsize;		/* size of the table, a power of 2 */
+
+static size_t encode(size_t number, unsigned char *key);
+
+static size_t hash(const char *name)
+{
+	size_t h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+	return h;
+}
+
+/* returns the application 'appid' or NULL if unknown, with the lock held */
+static struct appid *lookup(const char *appid)
+{
+	size_t i;
+	uint32_t n;
+
+	if (!tsize)
+		return NULL;
+	for (i = hash(appid) & (tsize - 1) ; (n = table[i]) ; i = (i + 1) & (tsize - 1))
+		if (!strcmp(apps[n - 1]->name, appid))
+			return apps[n - 1];
+	return NULL;
+}
+
+/* records in memory the application 'name' of 'number', with the lock held for writing */
+static struct appid *enter(const char *name, size_t number)
+{
+	size_t i, j, n;
+	uint32_t *t;
+	struct appid **s, *app;
+
+	if (number >= allocated)
+	{
+		n = allocated ? allocated : 16;
+		while (n <= number)
+			n *= 2;
+		s = realloc(apps, n * sizeof *apps);
+		if (!s)
+			return NULL;
+		memset(&s[allocated], 0, (n - allocated) * sizeof *s);
+		apps = s;
+		allocated = n;
+	}
+
+	/* the table is kept at most half full */
+	if (2 * (count + 1) > tsize)
+	{
+		n = tsize ? 2 * tsize : 64;
+		t = calloc(n, sizeof *t);
+		if (!t)
+			return NULL;
+		for (i = 0 ; i < tsize ; i++)
+			if (table[i])
+			{
+				for (j = hash(apps[table[i] - 1]->name) & (n - 1) ; t[j] ; j = (j + 1) & (n - 1));
+				t[j] = table[i];
+			}
+		free(table);
+		table = t;
+		tsize = n;
+	}
+
+	/* the applications are never freed */
+	app = malloc(sizeof *app + strlen(name) + 1);
+	if (!app)
+		return NULL;
+	app->name = strcpy((char*)(app + 1), name);
+	app->size = encode(number, app->number);
+
+	for (i = hash(name) & (tsize - 1) ; table[i] ; i = (i + 1) & (tsize - 1));
+	table[i] = (uint32_t)number + 1;
+	apps[number] = app;
+	if (number >= count)
+		count = number + 1;
+	return app;
+}
+
+/* encodes 'number' in 'key' and returns its size */
+static size_t encode(size_t number, unsigned char *key)
+{
+	if (number < (1U << 6))
+	{
+		key[0] = (unsigned char)(0x80 | number);
+		return 1;
+	}
+	if (number < (1U << 13))
+	{
+		key[0] = (unsigned char)(0xc0 | (number >> 8));
+		key[1] = (unsigned char)number;
+		return 2;
+	}
+	if (number < (1U << 20))
+	{
+		key[0] = (unsigned char)(0xe0 | (number >> 16));
+		key[1] = (unsigned char)(number >> 8);
+		key[2] = (unsigned char)number;
+		return 3;
+	}
+	key[0] = (unsigned char)(0xf0 | (number >> 24));
+	key[1] = (unsigned char)(number >> 16);
+	key[2] = (unsigned char)(number >> 8);
+	key[3] = (unsigned char)number;
+	return 4;
+}
+
+/* decodes in 'number' the number beginning 'key' and returns its size or 0 if none */
+static size_t decode(const unsigned char *key, size_t size, size_t *number)
+{
+	size_t n, i, len;
+
+	if (!size || key[0] < 0x80)
+		return 0;
+	len = key[0] < 0xc0 ? 1 : key[0] < 0xe0 ? 2 : key[0] < 0xf0 ? 3 : 4;
+	if (size < len)
+		return 0;
+	n = key[0] & (len < 4 ? 0x7f >> len : 0x0f);
+	for (i = 1 ; i < len ; i++)
+		n = (n << 8) | key[i];
+	*number = n;
+	return len;
+}
+
+/**
+ * Returns the application 'appid', giving it a number if needed, or
+ * NULL on error. The application stays valid until the end.
+ */
+const struct appid *appids_get(const char *appid)
+{
+	struct appid *app;
+	size_t len;
+	char *mkey, mvalue[16];
+	DATA key, data;
+	int ret;
+
+	pthread_rwlock_rdlock(&lock);
+	app = lookup(appid);
+	pthread_rwlock_unlock(&lock);
+	if (app)
+		return app;
+
+	pthread_rwlock_wrlock(&lock);
+	app = lookup(appid);
+	if (!app)
+	{
+		/* the record of the dictionary is written first */
+		len = strlen(appid);
+		mkey = malloc(len + 2);
+		ret = -1;
+		if (mkey && count < NUMBER_LIMIT)
+		{
+			mkey[0] = 0;
+			memcpy(&mkey[1], appid, len + 1);
+			DATA_SET(&key, mkey, len + 2);
+			DATA_SET(&data, mvalue, (size_t)snprintf(mvalue, sizeof mvalue, "%zu", count) + 1);
+			ret = xdb_put(&key, &data, 1);
+			/* the number must survive a crash before any record uses it */
+			if (ret == 0)
+				ret = xdb_sync();
+			if (ret == 0)
+				app = enter(appid, count);
+		}
+		free(mkey);
+		if (!app)
+			AFB_ERROR("can't give a number to the application %s", appid);
+	}
+	pthread_rwlock_unlock(&lock);
+	return app;
+}
+
+/**
+ * Returns the offset of the key of the application in the database 'key'
+ * of 'size' bytes or 0 if 'key' isn't the key of an application
+ */
+size_t appids_skip(const void *key, size_t size)
+{
+	size_t number;
+
+	return decode(key, size, &number);
+}
+
+/**
+ * Returns the application id of the database 'key' of 'size' bytes
+ * or NULL if 'key' isn't the key of a known application
+ */
+const char *appids_name(const void *key, size_t size)
+{
+	size_t number;
+	const char *name;
+
+	if (!decode(key, size, &number))
+		return NULL;
+
+	pthread_rwlock_rdlock(&lock);
+	name = number < count && apps[number] ? apps[number]->name : NULL;
+	pthread_rwlock_unlock(&lock);
+	return name;
+}
+
+/**
+ * Writes in 'text', of 'max' bytes, the text "appid:key" of the database
+ * 'key' of 'size' bytes, that includes the tailing null of 'key'.
+ * Returns the size of the text, that is greater than 'max' if 'text' is
+ * too small, or 0 if 'key' isn't the key of a known application.
+ */
+size_t appids_text(const void *key, size_t size, char *text, size_t max)
+{
+	const char *name;
+	size_t skip, lname, length;
+
+	skip = appids_skip(key, size);
+	name = appids_name(key, size);
+	if (!name)
+		return 0;
+
+	lname = strlen(name);
+	length = lname + 1 + size - skip;
+	if (length <= max)
+	{
+		memcpy(text, name, lname);
+		text[lname] = ':';
+		memcpy(&text[lname + 1], (const char*)key + skip, size - skip);
+	}
+	return length;
+}
+
+/**
+ * Returns the application 'appid' or NULL if it has no number
+ */
+const struct appid *appids_find(const char *appid)
+{
+	struct appid *app;
+
+	pthread_rwlock_rdlock(&lock);
+	app = lookup(appid);
+	pthread_rwlock_unlock(&lock);
+	return app;
+}
+
+/**
+ * Writes in 'key', of at least 'size' + APPIDS_NUMBER_MAX bytes, the
+ * database key of the text "appid:key" of 'size' bytes, giving a number
+ * to the application if needed and 'create' is set. Returns the size of
+ * the key or 0 if 'text' has no colon, if the application is unknown and
+ * not created or on error.
+ */
+size_t appids_key(const char *text, size_t size, char *key, int create)
+{
+	const struct appid *app;
+	const char *colon;
+	char *appid;
+	size_t lappid;
+
+	colon = memchr(text, ':', size);
+	if (!colon)
+		return 0;
+
+	lappid = (size_t)(colon - text);
+	appid = strndup(text, lappid);
+	app = !appid ? NULL : create ? appids_get(appid) : appids_find(appid);
+	free(appid);
+	if (!app)
+		return 0;
+
+	memcpy(key, app->number, app->size);
+	memcpy(&key[app->size], colon + 1, size - lappid - 1);
+	return app->size + size - lappid - 1;
+}
+
+/**
+ * Returns the count of applications in the dictionary
+ */
+size_t appids_count()
+{
+	size_t n;
+
+	pthread_rwlock_rdlock(&lock);
+	n = count;
+	pthread_rwlock_unlock(&lock);
+	return n;
+}
+
+/* loads the records of the dictionary, the version is recorded in 'closure' */
+static int load_cb(void *closure, DATA *key, DATA *data)
+{
+	char *end;
+	unsigned long number;
+
+	if (DATA_SZ(*key) == 1)
+	{
+		*(int*)closure = 1;
+		return 0;
+	}
+
+	number = NUMBER_LIMIT;
+	if (DATA_SZ(*data) && !DATA_STR(*data)[DATA_SZ(*data) - 1])
+	{
+		number = strtoul(DATA_STR(*data), &end, 10);
+		if (end == DATA_STR(*data) || *end)
+			number = NUMBER_LIMIT;
+	}
+	if (DATA_STR(*key)[DATA_SZ(*key) - 1] || number >= NUMBER_LIMIT || (number < count && apps[number]))
+	{
+		AFB_ERROR("invalid record of the application %.*s", (int)DATA_SZ(*key) - 1, &DATA_STR(*key)[1]);
+		return 0;
+	}
+
+	if (!enter(&DATA_STR(*key)[1], number))
+	{
+		*(int*)closure = -1;
+		return 1;
+	}
+	return 0;
+}
+
+/* the records to migrate */
+struct migration
+{
+	size_t count;
+	DATA keys[MIGRATE_BATCH];
+	DATA data[MIGRATE_BATCH];
+	int error;
+};
+
+/* collects the records "appid:key" */
+static int migrate_cb(void *closure, DATA *key, DATA *data)
+{
+	struct migration *m = closure;
+	unsigned char first;
+	void *k, *d;
+
+	first = DATA_SZ(*key) ? *(unsigned char*)DATA_PTR(*key) : 0;
+	if (first == 0 || first >= 0x80 || DATA_STR(*key)[DATA_SZ(*key) - 1]
+	 || !memchr(DATA_PTR(*key), ':', DATA_SZ(*key)))
+		return 0;
+
+	k = malloc(DATA_SZ(*key));
+	d = malloc(DATA_SZ(*data));
+	if (!k || !d)
+	{
+		free(k);
+		free(d);
+		m->error = 1;
+		return 1;
+	}
+	memcpy(k, DATA_PTR(*key), DATA_SZ(*key));
+	memcpy(d, DATA_PTR(*data), DATA_SZ(*data));
+	DATA_SET(&m->keys[m->count], k, DATA_SZ(*key));
+	DATA_SET(&m->data[m->count], d, DATA_SZ(*data));
+	return ++m->count == MIGRATE_BATCH;
+}
+
+/* rewrites the records "appid:key" with the numbers of the applications */
+static int migrate()
+{
+	struct migration *m;
+	DATA all, key;
+	size_t i, total, size;
+	char *buffer;
+	int ret;
+
+	m = malloc(sizeof *m);
+	if (!m)
+		return -1;
+
+	/* collects a batch then rewrites it, until no old record remains */
+	DATA_SET(&all, "", 0);
+	total = 0;
+	do
+	{
+		m->count = 0;
+		m->error = 0;
+		ret = xdb_scan(&all, &all, 1, migrate_cb, m);
+		if (ret == 0 && m->error)
+			ret = -1;
+		for (i = 0 ; i < m->count ; i++)
+		{
+			size = DATA_SZ(m->keys[i]);
+			buffer = ret == 0 ? malloc(size + APPIDS_NUMBER_MAX) : NULL;
+			if (ret == 0)
+			{
+				size = buffer ? appids_key(DATA_STR(m->keys[i]), size, buffer, 1) : 0;
+				DATA_SET(&key, buffer, size);
+				if (!size)
+					ret = -1;
+				else if (!(ret = xdb_put(&key, &m->data[i], 1)))
+					ret = xdb_delete(&m->keys[i]);
+			}
+			free(buffer);
+			free(DATA_PTR(m->keys[i]));
+			free(DATA_PTR(m->data[i]));
+		}
+		total += m->count;
+	}
+	while (ret == 0 && m->count == MIGRATE_BATCH);
+	free(m);
+
+	if (ret == 0)
+	{
+		DATA_SET(&key, "", 1);
+		DATA_SET(&all, VERSION, sizeof VERSION);
+		ret = xdb_put(&key, &all, 1);
+	}
+	if (ret == 0)
+		ret = xdb_sync();
+	if (ret != 0)
+		AFB_ERROR("can't migrate the keys of the database");
+	else if (total)
+		AFB_INFO("%zu key(s) migrated", total);
+	return ret;
+}
+
+/**
+ * Loads the dictionary from the open database, migrating the database
+ * if it has the keys "appid:key". Returns 0 or -1 on error.
+ */
+int appids_init()
+{
+	DATA prefix;
+	int version, ret;
+
+	version = 0;
+	DATA_SET(&prefix, "", 1);
+	ret = xdb_scan(&prefix, &prefix, 1, load_cb, &version);
+	if (ret != 0 || version < 0)
+	{
+		AFB_ERROR("can't load the applications");
+		return -1;
+	}
+	if (!version && migrate())
+		return -1;
+	return 0;
+}
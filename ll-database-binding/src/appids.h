@@ -0,0 +1,39 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "xdb.h"
+
+#define APPIDS_NUMBER_MAX	4	/* maximum size of the number of an application in a key */
+
+struct appid
+{
+	const char *name;				/* the application id */
+	size_t size;					/* size of the number */
+	unsigned char number[APPIDS_NUMBER_MAX];	/* the number, that begins the keys */
+};
+
+extern int appids_init();
+extern const struct appid *appids_get(const char *appid);
+extern const struct appid *appids_find(const char *appid);
+extern size_t appids_skip(const void *key, size_t size);
+extern const char *appids_name(const void *key, size_t size);
+extern size_t appids_text(const void *key, size_t size, char *text, size_t max);
+extern size_t appids_key(const char *text, size_t size, char *key, int create);
+extern size_t appids_count();
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bloom.h"
+
+/*
+ * Bloom filter of keys. A key sets 'hashes' bits of the filter chosen by
+ * double hashing of its 64 bits hash. A key that doesn't have all its
+ * bits set was never added. The bits are set with atomic operations so
+ * that several threads can add keys at the same time, the tests don't
+ * lock anything.
+ */
+#define BITS_MIN	65536
+
+struct bloom
+{
+	uint64_t mask;		/* count of bits minus one, a power of 2 minus one */
+	unsigned hashes;	/* count of bits by key */
+	size_t set;		/* count of bits set */
+	uint64_t words[];	/* the bits */
+};
+
+/* FNV-1a finished by the mixer of splitmix64 */
+static uint64_t hash(const void *key, size_t size)
+{
+	const unsigned char *p = key;
+	uint64_t h = 14695981039346656037ULL;
+
+	while (size--)
+		h = (h ^ *p++) * 1099511628211ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+/**
+ * Creates a filter for 'keys' keys with 'bits_per_key' bits by key.
+ * Returns the filter or NULL if out of memory.
+ */
+struct bloom *bloom_create(size_t keys, unsigned bits_per_key)
+{
+	struct bloom *bloom;
+	uint64_t bits;
+
+	for (bits = BITS_MIN ; bits < (uint64_t)keys * bits_per_key ; bits *= 2);
+	bloom = calloc(1, sizeof *bloom + bits / 8);
+	if (bloom)
+	{
+		bloom->mask = bits - 1;
+		/* the best count of hashes is bits_per_key * ln(2) */
+		bloom->hashes = (bits_per_key * 69 + 50) / 100 ?: 1;
+	}
+	return bloom;
+}
+
+/**
+ * Destroys the filter
+ */
+void bloom_destroy(struct bloom *bloom)
+{
+	free(bloom);
+}
+
+/**
+ * Adds the 'key' of 'size' bytes. Returns the count of bits newly set.
+ */
+int bloom_add(struct bloom *bloom, const void *key, size_t size)
+{
+	uint64_t h, delta, bit, old;
+	unsigned i;
+	int n;
+
+	h = hash(key, size);
+	delta = (h >> 32) | 1;
+	for (n = 0, i = 0 ; i < bloom->hashes ; i++, h += delta)
+	{
+		bit = h & bloom->mask;
+		old = __atomic_fetch_or(&bloom->words[bit / 64], 1ULL << (bit % 64), __ATOMIC_RELAXED);
+		n += !(old & (1ULL << (bit % 64)));
+	}
+	if (n)
+		__atomic_add_fetch(&bloom->set, (size_t)n, __ATOMIC_RELAXED);
+	return n;
+}
+
+/**
+ * Tests the 'key' of 'size' bytes. Returns 0 if it was never added or 1
+ * if it may have been added.
+ */
+int bloom_test(struct bloom *bloom, const void *key, size_t size)
+{
+	uint64_t h, delta, bit;
+	unsigned i;
+
+	h = hash(key, size);
+	delta = (h >> 32) | 1;
+	for (i = 0 ; i < bloom->hashes ; i++, h += delta)
+	{
+		bit = h & bloom->mask;
+		if (!(__atomic_load_n(&bloom->words[bit / 64], __ATOMIC_RELAXED) & (1ULL << (bit % 64))))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Gets the statistics of the filter. The rate of false positives is
+ * estimated as the probability of hitting 'hashes' set bits.
+ */
+void bloom_get_stats(struct bloom *bloom, struct bloom_stats *stats)
+{
+	double fill;
+	unsigned i;
+
+	stats->bits = (size_t)bloom->mask + 1;
+	stats->hashes = bloom->hashes;
+	stats->set = __atomic_load_n(&bloom->set, __ATOMIC_RELAXED);
+	fill = (double)stats->set / (double)stats->bits;
+	for (stats->fp_rate = 1, i = 0 ; i < bloom->hashes ; i++)
+		stats->fp_rate *= fill;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+struct bloom;
+
+struct bloom_stats
+{
+	size_t bits;		/* count of bits */
+	unsigned hashes;	/* count of bits set by key */
+	size_t set;		/* count of bits set */
+	double fp_rate;		/* estimated rate of false positives */
+};
+
+extern struct bloom *bloom_create(size_t keys, unsigned bits_per_key);
+extern void bloom_destroy(struct bloom *bloom);
+extern int bloom_add(struct bloom *bloom, const void *key, size_t size);
+extern int bloom_test(struct bloom *bloom, const void *key, size_t size);
+extern void bloom_get_stats(struct bloom *bloom, struct bloom_stats *stats);
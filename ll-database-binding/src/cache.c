@@ -0,0 +1,360 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <json-c/json.h>
+
+#include "cache.h"
+
+/*
+ * Bounded cache of values indexed by their database key.
+ * Entries are both in a hash table and in a list ordered from the
+ * most recently used (head) to the least recently used (tail).
+ * The counts of references and the print buffers of the json objects
+ * are changed without lock, so a cached object is never given: it is
+ * only read, by the deep copy that each hit returns, which is several
+ * times faster than parsing the json text again. The object is shared
+ * by the entry and the hits copying it, the last one frees it. A
+ * rewrite reuses the shared object of the entry when no hit holds it.
+ *
+ * The readers filling the cache hold no lock while they read the
+ * backend, so each write of a key bumps the stamp of its stripe and a
+ * reader only fills the cache if the stamp it took before reading the
+ * backend didn't change: else it could cache the value that a writer
+ * just replaced.
+ */
+#define STAMPS	256		/* count of stripes, a power of 2 */
+
+struct shared
+{
+	unsigned refs;			/* count of holders */
+	struct json_object *object;	/* the cached value, only read */
+};
+
+struct entry
+{
+	struct entry *hnext;		/* next in the bucket */
+	struct entry *prev;		/* previous in the lru list */
+	struct entry *next;		/* next in the lru list */
+	struct shared *value;		/* the cached value */
+	time_t expiry;			/* expiry time of the value or zero */
+	uint32_t hash;			/* hash of the key */
+	size_t size;			/* size of the key */
+	char key[];			/* the key */
+};
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct entry **buckets;
+static uint32_t mask;
+static struct entry *head, *tail;
+static struct cache_stats stats;
+static unsigned stamps[STAMPS];
+
+static uint32_t hash_key(const void *key, size_t size)
+{
+	const unsigned char *p = key;
+	uint32_t h = 2166136261u;
+
+	while (size--)
+		h = (h ^ *p++) * 16777619u;
+	return h;
+}
+
+/* returns the pointer to the link that points the entry of key */
+static struct entry **search(const void *key, size_t size, uint32_t hash)
+{
+	struct entry **prv, *e;
+
+	prv = &buckets[hash & mask];
+	while ((e = *prv) && (e->hash != hash || e->size != size || memcmp(e->key, key, size)))
+		prv = &e->hnext;
+	return prv;
+}
+
+static void unlink_lru(struct entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		tail = e->prev;
+}
+
+static void link_lru(struct entry *e)
+{
+	e->prev = NULL;
+	e->next = head;
+	if (head)
+		head->prev = e;
+	else
+		tail = e;
+	head = e;
+}
+
+static void release(struct shared *value)
+{
+	if (!__atomic_sub_fetch(&value->refs, 1, __ATOMIC_ACQ_REL))
+	{
+		json_object_put(value->object);
+		free(value);
+	}
+}
+
+static void remove_entry(struct entry **prv)
+{
+	struct entry *e = *prv;
+
+	*prv = e->hnext;
+	unlink_lru(e);
+	release(e->value);
+	free(e);
+	stats.entries--;
+}
+
+/**
+ * Initialize the cache for 'capacity' entries, zero disables it
+ */
+int cache_init(size_t capacity)
+{
+	uint32_t n;
+
+	stats.capacity = capacity;
+	if (!capacity)
+		return 0;
+
+	for (n = 16 ; n < capacity ; n <<= 1);
+	buckets = calloc(n, sizeof *buckets);
+	if (!buckets)
+	{
+		stats.capacity = 0;
+		return -1;
+	}
+	mask = n - 1;
+	return 0;
+}
+
+/**
+ * Returns a new copy of the value cached for 'key' or NULL.
+ * An expired value is dropped. If 'expiry' isn't NULL, it receives the
+ * expiry time of the value or zero.
+ */
+struct json_object *cache_get(const void *key, size_t size, time_t *expiry)
+{
+	struct entry *e, **prv;
+	struct json_object *value;
+	struct shared *shared;
+
+	if (!stats.capacity)
+		return NULL;
+
+	pthread_mutex_lock(&mutex);
+	prv = search(key, size, hash_key(key, size));
+	e = *prv;
+	if (e && e->expiry && e->expiry <= time(NULL))
+	{
+		remove_entry(prv);
+		e = NULL;
+	}
+	if (!e)
+	{
+		stats.misses++;
+		shared = NULL;
+	}
+	else
+	{
+		stats.hits++;
+		if (e != head)
+		{
+			unlink_lru(e);
+			link_lru(e);
+		}
+		shared = e->value;
+		__atomic_add_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL);
+		if (expiry)
+			*expiry = e->expiry;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (!shared)
+		return NULL;
+	value = NULL;
+	if (json_object_deep_copy(shared->object, &value, NULL) < 0)
+		value = NULL;
+	release(shared);
+	return value;
+}
+
+/* caches a copy of value for a write if stamp is NULL, else for a read */
+static void store(const void *key, size_t size, struct json_object *value, time_t expiry, const unsigned *stamp)
+{
+	uint32_t hash;
+	struct entry *e, **prv;
+	struct json_object *copy;
+	struct shared *shared;
+
+	/* the null value, a NULL object, isn't cached */
+	copy = NULL;
+	if (!value || json_object_deep_copy(value, &copy, NULL) < 0)
+	{
+		if (!stamp)
+			cache_drop(key, size);
+		return;
+	}
+
+	hash = hash_key(key, size);
+	pthread_mutex_lock(&mutex);
+	if (stamp && *stamp != stamps[hash & (STAMPS - 1)])
+	{
+		/* written since the read */
+		json_object_put(copy);
+		goto end;
+	}
+	if (!stamp)
+		stamps[hash & (STAMPS - 1)]++;
+	prv = search(key, size, hash);
+	e = *prv;
+	if (e && __atomic_load_n(&e->value->refs, __ATOMIC_ACQUIRE) == 1)
+	{
+		/* no hit holds it: the holders are counted under the lock */
+		shared = e->value;
+		json_object_put(shared->object);
+	}
+	else
+	{
+		shared = malloc(sizeof *shared);
+		if (!shared)
+		{
+			json_object_put(copy);
+			if (e)
+				remove_entry(prv);
+			goto end;
+		}
+		shared->refs = 1;
+	}
+	shared->object = copy;
+
+	if (e)
+	{
+		if (shared != e->value)
+		{
+			release(e->value);
+			e->value = shared;
+		}
+		unlink_lru(e);
+	}
+	else
+	{
+		e = malloc(sizeof *e + size);
+		if (!e)
+		{
+			release(shared);
+			goto end;
+		}
+		e->value = shared;
+		if (stats.entries == stats.capacity)
+		{
+			remove_entry(search(tail->key, tail->size, tail->hash));
+			stats.evictions++;
+			prv = search(key, size, hash);
+		}
+		e->hnext = NULL;
+		e->hash = hash;
+		e->size = size;
+		memcpy(e->key, key, size);
+		*prv = e;
+		stats.entries++;
+	}
+	e->expiry = expiry;
+	link_lru(e);
+end:
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Caches for 'key' a copy of the written 'value' that expires at
+ * 'expiry' or never if zero. The calling thread must own 'value'.
+ */
+void cache_set(const void *key, size_t size, struct json_object *value, time_t expiry)
+{
+	if (stats.capacity)
+		store(key, size, value, expiry, NULL);
+}
+
+/**
+ * Returns the stamp to give to 'cache_fill' for 'key', to be taken
+ * before reading its value from the backend
+ */
+unsigned cache_stamp(const void *key, size_t size)
+{
+	unsigned stamp;
+
+	if (!stats.capacity)
+		return 0;
+
+	pthread_mutex_lock(&mutex);
+	stamp = stamps[hash_key(key, size) & (STAMPS - 1)];
+	pthread_mutex_unlock(&mutex);
+	return stamp;
+}
+
+/**
+ * Caches for 'key' a copy of the read 'value' as 'cache_set' does,
+ * unless a write of a key of its stripe happened since 'stamp' was
+ * taken. The calling thread must own 'value'.
+ */
+void cache_fill(const void *key, size_t size, struct json_object *value, time_t expiry, unsigned stamp)
+{
+	if (stats.capacity)
+		store(key, size, value, expiry, &stamp);
+}
+
+/**
+ * Removes the value cached for 'key' if any
+ */
+void cache_drop(const void *key, size_t size)
+{
+	uint32_t hash;
+	struct entry **prv;
+
+	if (!stats.capacity)
+		return;
+
+	hash = hash_key(key, size);
+	pthread_mutex_lock(&mutex);
+	stamps[hash & (STAMPS - 1)]++;
+	prv = search(key, size, hash);
+	if (*prv)
+		remove_entry(prv);
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Copies the statistics of the cache to 'result'
+ */
+void cache_get_stats(struct cache_stats *result)
+{
+	pthread_mutex_lock(&mutex);
+	*result = stats;
+	pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+
+struct json_object;
+
+struct cache_stats
+{
+	size_t capacity;
+	size_t entries;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+};
+
+extern int cache_init(size_t capacity);
+extern struct json_object *cache_get(const void *key, size_t size, time_t *expiry);
+extern void cache_set(const void *key, size_t size, struct json_object *value, time_t expiry);
+extern unsigned cache_stamp(const void *key, size_t size);
+extern void cache_fill(const void *key, size_t size, struct json_object *value, time_t expiry, unsigned stamp);
+extern void cache_drop(const void *key, size_t size);
+extern void cache_get_stats(struct cache_stats *stats);
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dump.h"
+
+static size_t varint_size(size_t value)
+{
+	size_t n;
+
+	for (n = 1 ; value >= 128 ; n++)
+		value >>= 7;
+	return n;
+}
+
+static char *put_varint(char *buffer, size_t value)
+{
+	while (value >= 128)
+	{
+		*buffer++ = (char)((value & 127) | 128);
+		value >>= 7;
+	}
+	*buffer++ = (char)value;
+	return buffer;
+}
+
+/* reads in 'value' the varint at 'buffer', returns the byte after or NULL if invalid */
+static const char *get_varint(const char *buffer, const char *end, size_t *value)
+{
+	unsigned shift;
+	unsigned char c;
+
+	*value = 0;
+	for (shift = 0 ; buffer < end && shift < 8 * sizeof *value ; shift += 7)
+	{
+		c = (unsigned char)*buffer++;
+		*value |= (size_t)(c & 127) << shift;
+		if (!(c & 128))
+			return buffer;
+	}
+	return NULL;
+}
+
+/**
+ * Returns the size of the record of a key of 'ksize' bytes and a
+ * value of 'vsize' bytes
+ */
+size_t dump_record_size(size_t ksize, size_t vsize)
+{
+	return varint_size(ksize) + ksize + varint_size(vsize) + vsize;
+}
+
+/**
+ * Writes at 'buffer' the record of 'key' and 'value', it has to hold
+ * 'dump_record_size' bytes. Returns the byte after the record.
+ */
+char *dump_record(char *buffer, const void *key, size_t ksize, const void *value, size_t vsize)
+{
+	buffer = put_varint(buffer, ksize);
+	memcpy(buffer, key, ksize);
+	buffer = put_varint(buffer + ksize, vsize);
+	memcpy(buffer, value, vsize);
+	return buffer + vsize;
+}
+
+/**
+ * Reads the record at '*buffer', before 'end', and moves '*buffer' after it.
+ * The key and the value point into the buffer.
+ * Returns 1 if a record is read, 0 at the end or -1 if the record is truncated
+ */
+int dump_next(const char **buffer, const char *end, const void **key, size_t *ksize, const void **value, size_t *vsize)
+{
+	const char *p = *buffer;
+
+	if (p == end)
+		return 0;
+	p = get_varint(p, end, ksize);
+	if (!p || *ksize > (size_t)(end - p))
+		return -1;
+	*key = p;
+	p = get_varint(p + *ksize, end, vsize);
+	if (!p || *vsize > (size_t)(end - p))
+		return -1;
+	*value = p;
+	*buffer = p + *vsize;
+	return 1;
+}
+
+// ----- Base64 -----
+
+static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * Returns the size of the base64 text of 'size' bytes, without the tailing null
+ */
+size_t dump_base64_size(size_t size)
+{
+	return (size + 2) / 3 * 4;
+}
+
+/**
+ * Writes in 'text' the null terminated base64 text of the 'size' bytes
+ * of 'buffer'. 'text' has to hold 'dump_base64_size' + 1 bytes.
+ */
+void dump_to_base64(char *text, const char *buffer, size_t size)
+{
+	const unsigned char *p = (const unsigned char*)buffer;
+	uint32_t v;
+
+	for (; size >= 3 ; size -= 3, p += 3)
+	{
+		v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+		*text++ = digits[v >> 18];
+		*text++ = digits[v >> 12 & 63];
+		*text++ = digits[v >> 6 & 63];
+		*text++ = digits[v & 63];
+	}
+	if (size)
+	{
+		v = (uint32_t)p[0] << 16 | (size > 1 ? (uint32_t)p[1] << 8 : 0);
+		*text++ = digits[v >> 18];
+		*text++ = digits[v >> 12 & 63];
+		*text++ = size > 1 ? digits[v >> 6 & 63] : '=';
+		*text++ = '=';
+	}
+	*text = 0;
+}
+
+/**
+ * Returns the bytes, in 'size', of the base64 'text' of 'length' characters.
+ * The result has to be freed. Returns NULL if out of memory or invalid.
+ */
+char *dump_from_base64(const char *text, size_t length, size_t *size)
+{
+	char *buffer, *p;
+	const char *d;
+	uint32_t v;
+	unsigned n;
+
+	while (length && text[length - 1] == '=')
+		length--;
+	buffer = malloc(length / 4 * 3 + 3);
+	if (!buffer)
+		return NULL;
+
+	p = buffer;
+	v = n = 0;
+	while (length--)
+	{
+		d = memchr(digits, *text++, 64);
+		if (!d)
+		{
+			free(buffer);
+			return NULL;
+		}
+		v = v << 6 | (uint32_t)(d - digits);
+		if (++n == 4)
+		{
+			*p++ = (char)(v >> 16);
+			*p++ = (char)(v >> 8);
+			*p++ = (char)v;
+			v = n = 0;
+		}
+	}
+	if (n == 1)
+	{
+		free(buffer);
+		return NULL;
+	}
+	if (n == 2)
+		*p++ = (char)(v >> 4);
+	else if (n == 3)
+	{
+		*p++ = (char)(v >> 10);
+		*p++ = (char)(v >> 2);
+	}
+	*size = (size_t)(p - buffer);
+	return buffer;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Backend independent format of the records: each record is the size of
+ * its key, the key, the size of its value then the value, as stored.
+ * The sizes are unsigned LEB128 varints. A dump file starts with
+ * DUMP_MAGIC followed by the records.
+ */
+#define DUMP_MAGIC       "LLDBDMP1"
+#define DUMP_MAGIC_SIZE  8
+
+extern size_t dump_record_size(size_t ksize, size_t vsize);
+extern char *dump_record(char *buffer, const void *key, size_t ksize, const void *value, size_t vsize);
+extern int dump_next(const char **buffer, const char *end, const void **key, size_t *ksize, const void **value, size_t *vsize);
+
+extern size_t dump_base64_size(size_t size);
+extern void dump_to_base64(char *text, const char *buffer, size_t size);
+extern char *dump_from_base64(const char *text, size_t length, size_t *size);
@@ -0,0 +1,265 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "expiry.h"
+
+/*
+ * Index of the keys that expire: a binary heap ordered by expiry time,
+ * with one entry by key. A hash table, with open addressing, gives the
+ * position in the heap of each key: a new expiry of a key moves its
+ * entry instead of adding one. The entry of a key rewritten without
+ * expiry or deleted is left until due: the taker checks the stored
+ * record before removing it.
+ */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct expiry_entry *heap;
+static size_t *slots;		/* slot in the table of each entry of the heap */
+static size_t *table;		/* 1 + position in the heap, 0 for a free slot */
+static size_t count, size, mask;
+
+static size_t hash_key(const void *key, size_t size)
+{
+	const unsigned char *p = key;
+	uint32_t h = 2166136261u;
+
+	while (size--)
+		h = (h ^ *p++) * 16777619u;
+	return h;
+}
+
+/* returns the slot of the table of key or else the free slot for it */
+static size_t lookup(const void *key, size_t ksize)
+{
+	size_t i, n;
+
+	for (i = hash_key(key, ksize) & mask ; (n = table[i]) ; i = (i + 1) & mask)
+		if (heap[n - 1].size == ksize && !memcmp(heap[n - 1].key, key, ksize))
+			break;
+	return i;
+}
+
+/* frees the slot i of the table, moving back the entries that follow */
+static void unlink_slot(size_t i)
+{
+	size_t j, k;
+
+	for (;;)
+	{
+		table[i] = 0;
+		for (j = (i + 1) & mask ; table[j] ; j = (j + 1) & mask)
+		{
+			/* the entry of j moves to i unless its first slot is in ]i, j] */
+			k = hash_key(heap[table[j] - 1].key, heap[table[j] - 1].size) & mask;
+			if (i <= j ? (k <= i || k > j) : (k <= i && k > j))
+				break;
+		}
+		if (!table[j])
+			return;
+		table[i] = table[j];
+		slots[table[i] - 1] = i;
+		i = j;
+	}
+}
+
+/* doubles the heap and rebuilds the table at twice its size */
+static int grow()
+{
+	struct expiry_entry *newheap;
+	size_t *newslots, *newtable;
+	size_t n, newsize, i;
+
+	newsize = size ? 2 * size : 64;
+	newheap = realloc(heap, newsize * sizeof *heap);
+	if (!newheap)
+		return -1;
+	heap = newheap;
+	newslots = realloc(slots, newsize * sizeof *slots);
+	if (!newslots)
+		return -1;
+	slots = newslots;
+	newtable = calloc(2 * newsize, sizeof *table);
+	if (!newtable)
+		return -1;
+	free(table);
+	table = newtable;
+	mask = 2 * newsize - 1;
+	size = newsize;
+	for (n = 0 ; n < count ; n++)
+	{
+		i = lookup(heap[n].key, heap[n].size);
+		table[i] = n + 1;
+		slots[n] = i;
+	}
+	return 0;
+}
+
+static void swap(size_t i, size_t j)
+{
+	struct expiry_entry e = heap[i];
+	size_t s = slots[i];
+
+	heap[i] = heap[j];
+	heap[j] = e;
+	slots[i] = slots[j];
+	slots[j] = s;
+	table[slots[i]] = i + 1;
+	table[slots[j]] = j + 1;
+}
+
+/* returns the new position of the entry i */
+static size_t sift_up(size_t i)
+{
+	while (i && heap[(i - 1) / 2].expiry > heap[i].expiry)
+	{
+		swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+	return i;
+}
+
+static void sift_down(size_t i)
+{
+	size_t m, c;
+
+	for (;;)
+	{
+		m = i;
+		c = 2 * i + 1;
+		if (c < count && heap[c].expiry < heap[m].expiry)
+			m = c;
+		if (c + 1 < count && heap[c + 1].expiry < heap[m].expiry)
+			m = c + 1;
+		if (m == i)
+			break;
+		swap(i, m);
+		i = m;
+	}
+}
+
+/**
+ * Adds that 'key' expires at 'expiry', replacing its previous expiry
+ * Returns 0 or -1 if out of memory
+ */
+int expiry_add(const void *key, size_t ksize, time_t expiry)
+{
+	void *copy;
+	size_t i, n;
+	time_t previous;
+
+	pthread_mutex_lock(&mutex);
+	if (count == size && grow() < 0)
+	{
+		pthread_mutex_unlock(&mutex);
+		return -1;
+	}
+	i = lookup(key, ksize);
+	if (table[i])
+	{
+		n = table[i] - 1;
+		previous = heap[n].expiry;
+		heap[n].expiry = expiry;
+		if (expiry > previous)
+			sift_down(n);
+		else if (sift_up(n) == 0)
+			pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+		return 0;
+	}
+
+	copy = malloc(ksize);
+	if (!copy)
+	{
+		pthread_mutex_unlock(&mutex);
+		return -1;
+	}
+	memcpy(copy, key, ksize);
+	heap[count].expiry = expiry;
+	heap[count].size = ksize;
+	heap[count].key = copy;
+	slots[count] = i;
+	table[i] = count + 1;
+	if (sift_up(count++) == 0)
+		pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+/**
+ * Waits until the first key expires
+ */
+void expiry_wait()
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&mutex);
+	while (!count || heap[0].expiry > time(NULL))
+	{
+		if (!count)
+			pthread_cond_wait(&cond, &mutex);
+		else
+		{
+			ts.tv_sec = heap[0].expiry;
+			ts.tv_nsec = 0;
+			pthread_cond_timedwait(&cond, &mutex, &ts);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Takes in 'entries' at most 'max' of the keys expired at 'now'
+ * Returns the count of entries taken
+ */
+size_t expiry_take(time_t now, struct expiry_entry *entries, size_t max)
+{
+	size_t n;
+
+	pthread_mutex_lock(&mutex);
+	for (n = 0 ; n < max && count && heap[0].expiry <= now ; n++)
+	{
+		entries[n] = heap[0];
+		unlink_slot(slots[0]);
+		if (--count)
+		{
+			heap[0] = heap[count];
+			slots[0] = slots[count];
+			table[slots[0]] = 1;
+			sift_down(0);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	return n;
+}
+
+/**
+ * Returns the count of entries in the index
+ */
+size_t expiry_count()
+{
+	size_t n;
+
+	pthread_mutex_lock(&mutex);
+	n = count;
+	pthread_mutex_unlock(&mutex);
+	return n;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+
+struct expiry_entry
+{
+	time_t expiry;		/* expiry time of the key */
+	size_t size;		/* size of the key */
+	void *key;		/* the key, to be freed */
+};
+
+extern int expiry_add(const void *key, size_t size, time_t expiry);
+extern void expiry_wait();
+extern size_t expiry_take(time_t now, struct expiry_entry *entries, size_t count);
+extern size_t expiry_count();
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "jobs.h"
+
+/*
+ * Bounded queue of jobs run by a pool of threads.
+ * The jobs are in a ring of 'depth' slots.
+ */
+struct job
+{
+	void (*callback)(void*);
+	void *closure;
+	unsigned long long queued;	/* time of queuing in microseconds */
+};
+
+struct jobs
+{
+	const char *name;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	size_t head;			/* index of the next job to run */
+	struct jobs_stats stats;
+	struct job ring[];
+};
+
+static unsigned long long now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + (unsigned long long)ts.tv_nsec / 1000;
+}
+
+static void *run(void *arg)
+{
+	struct jobs *jobs = arg;
+	struct job job;
+	unsigned long long start, wait, duration;
+
+	pthread_mutex_lock(&jobs->mutex);
+	for (;;)
+	{
+		while (!jobs->stats.pending)
+			pthread_cond_wait(&jobs->cond, &jobs->mutex);
+
+		job = jobs->ring[jobs->head];
+		jobs->head = (jobs->head + 1) % jobs->stats.depth;
+		jobs->stats.pending--;
+		pthread_mutex_unlock(&jobs->mutex);
+
+		start = now_us();
+		job.callback(job.closure);
+		duration = now_us() - start;
+		wait = start - job.queued;
+
+		pthread_mutex_lock(&jobs->mutex);
+		jobs->stats.done++;
+		jobs->stats.wait_us += wait;
+		if (wait > jobs->stats.wait_max_us)
+			jobs->stats.wait_max_us = wait;
+		jobs->stats.run_us += duration;
+		if (duration > jobs->stats.run_max_us)
+			jobs->stats.run_max_us = duration;
+	}
+	return NULL;
+}
+
+/**
+ * Creates the queue 'name' of at most 'depth' pending jobs run by 'nthreads' threads
+ */
+struct jobs *jobs_create(const char *name, int nthreads, size_t depth)
+{
+	struct jobs *jobs;
+	pthread_t tid;
+	int i;
+
+	jobs = calloc(1, sizeof *jobs + depth * sizeof *jobs->ring);
+	if (!jobs)
+		return NULL;
+
+	jobs->name = name;
+	jobs->stats.depth = depth;
+	pthread_mutex_init(&jobs->mutex, NULL);
+	pthread_cond_init(&jobs->cond, NULL);
+	for (i = 0 ; i < nthreads ; i++)
+	{
+		if (pthread_create(&tid, NULL, run, jobs))
+			return NULL; /* started threads are holding it */
+		pthread_detach(tid);
+	}
+	return jobs;
+}
+
+/**
+ * Queues the job calling 'callback' with 'closure'
+ * Returns 0 on success or -1 with errno EBUSY if the queue is full
+ */
+int jobs_queue(struct jobs *jobs, void (*callback)(void*), void *closure)
+{
+	struct job *job;
+	int ret;
+
+	pthread_mutex_lock(&jobs->mutex);
+	if (jobs->stats.pending == jobs->stats.depth)
+	{
+		jobs->stats.rejected++;
+		errno = EBUSY;
+		ret = -1;
+	}
+	else
+	{
+		job = &jobs->ring[(jobs->head + jobs->stats.pending) % jobs->stats.depth];
+		job->callback = callback;
+		job->closure = closure;
+		job->queued = now_us();
+		if (++jobs->stats.pending > jobs->stats.max_pending)
+			jobs->stats.max_pending = jobs->stats.pending;
+		pthread_cond_signal(&jobs->cond);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&jobs->mutex);
+	return ret;
+}
+
+const char *jobs_name(struct jobs *jobs)
+{
+	return jobs->name;
+}
+
+/**
+ * Copies the statistics of 'jobs' to 'result'
+ */
+void jobs_get_stats(struct jobs *jobs, struct jobs_stats *result)
+{
+	pthread_mutex_lock(&jobs->mutex);
+	*result = jobs->stats;
+	pthread_mutex_unlock(&jobs->mutex);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+struct jobs;
+
+struct jobs_stats
+{
+	size_t depth;			/* maximum count of pending jobs */
+	size_t pending;			/* current count of pending jobs */
+	size_t max_pending;		/* highest count of pending jobs */
+	unsigned long long done;	/* count of jobs done */
+	unsigned long long rejected;	/* count of jobs rejected because the queue was full */
+	unsigned long long wait_us;	/* total time waited in the queue in microseconds */
+	unsigned long long wait_max_us;	/* longest time waited in the queue in microseconds */
+	unsigned long long run_us;	/* total time of running in microseconds */
+	unsigned long long run_max_us;	/* longest time of running in microseconds */
+};
+
+extern struct jobs *jobs_create(const char *name, int nthreads, size_t depth);
+extern int jobs_queue(struct jobs *jobs, void (*callback)(void*), void *closure);
+extern const char *jobs_name(struct jobs *jobs);
+extern void jobs_get_stats(struct jobs *jobs, struct jobs_stats *stats);
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Check of the allocations of the usual request path.
+ *
+ * It plays, with the code of the binding and without the binder, the
+ * steps of the verbs read and update: the key and the expiry header made
+ * in the scratch arena, the cache, and the reads and writes of the
+ * backend.
+ * malloc, calloc and realloc are interposed to count the allocations
+ * of each step once warmed up. The allocations made by the code of the
+ * binding, directly or through the C library (strdup...), must be none.
+ * Those made by json-c for its objects and by the backend for itself,
+ * as the values that gdbm_fetch allocates, are only reported.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <ftw.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+
+#include <json-c/json.h>
+
+#include "xdb.h"
+#include "appids.h"
+#include "cache.h"
+#include "scratch.h"
+#include "record.h"
+
+#define EXIT_SUCCESS		0
+#define EXIT_DATABASE		2
+#define EXIT_ALLOC			3
+#define EXIT_CHECK			4
+
+#define APPID				"allocs-app"
+#define KEYS				8
+#define WARMUP				64
+#define ROUNDS				1000
+#define FRAMES				4
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+/// @brief The counts of allocations of the calling thread, when counting.
+static __thread int counting;
+static __thread int inside;
+static __thread unsigned long own;
+static __thread unsigned long others;
+
+/// @brief The bounds of the code of the executable, set by the linker.
+extern char __executable_start[];
+extern char etext[];
+
+static int in_executable(void* address)
+{
+	return (char*)address >= __executable_start && (char*)address < etext;
+}
+
+static int in_libc(void* address)
+{
+	Dl_info info;
+	return dladdr(address, &info) && info.dli_fname && strstr(info.dli_fname, "/libc.so");
+}
+
+/// @brief Count an allocation: its first caller out of the C library tells who made it.
+/// The first frames are this function and the interposed function.
+static __attribute__((noinline)) void count()
+{
+	void* frames[FRAMES];
+	int n, i;
+
+	if (!counting || inside)
+		return;
+	inside = 1;
+	n = backtrace(frames, FRAMES);
+	for (i = 2; i < n - 1 && !in_executable(frames[i]) && in_libc(frames[i]); i++);
+	if (i < n && in_executable(frames[i]))
+		own++;
+	else
+		others++;
+	inside = 0;
+}
+
+void* malloc(size_t size)
+{
+	count();
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count_, size_t size)
+{
+	count();
+	return __libc_calloc(count_, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	count();
+	return __libc_realloc(ptr, size);
+}
+
+/// @brief Make in the scratch arena the database key of the key number @c n.
+static int make_key(const struct appid* app, unsigned n, DATA* key)
+{
+	char ukey[32];
+
+	snprintf(ukey, sizeof ukey, "key-%u", n);
+	return record_key(app, ukey, 1, scratch_alloc, key) ? -1 : 0;
+}
+
+/// @brief The step 'update': write a value and cache it.
+static int update(const struct appid* app, unsigned n)
+{
+	DATA key, data;
+	struct json_object* value;
+	char text[32];
+	time_t expiry;
+	int ret;
+
+	scratch_reset();
+	snprintf(text, sizeof text, "value-%06u", n);
+	value = json_object_new_string(text);
+	expiry = time(NULL) + 3600;
+	ret = !value || make_key(app, n, &key) || record_value(value, expiry, &data) || xdb_put(&key, &data, 1);
+	if (!ret)
+		cache_set(DATA_PTR(key), DATA_SZ(key), value, expiry);
+	json_object_put(value);
+	return ret;
+}
+
+/// @brief The step 'read' of a cached value.
+static int read_cached(const struct appid* app, unsigned n)
+{
+	DATA key;
+	struct json_object* value;
+
+	scratch_reset();
+	if (make_key(app, n, &key))
+		return -1;
+	value = cache_get(DATA_PTR(key), DATA_SZ(key), NULL);
+	if (!value)
+		return -1;
+	json_object_put(value);
+	return 0;
+}
+
+/// @brief The step 'read' of a value missing from the cache.
+static int read_backend(const struct appid* app, unsigned n)
+{
+	DATA key, data;
+
+	scratch_reset();
+	if (make_key(app, n, &key) || xdb_get(&key, &data))
+		return -1;
+	xdb_release(&data);
+	return 0;
+}
+
+/// @brief Warm up then count the allocations of @c step, returns the count of failures.
+static unsigned check(const char* name, int (*step)(const struct appid*, unsigned), const struct appid* app)
+{
+	unsigned i, errors;
+
+	errors = 0;
+	for (i = 0; i < WARMUP; i++)
+		errors += step(app, i % KEYS) != 0;
+
+	own = others = 0;
+	counting = 1;
+	for (i = 0; i < ROUNDS; i++)
+		errors += step(app, i % KEYS) != 0;
+	counting = 0;
+
+	printf("%-12s own %6.2f  json-c and backend %6.2f allocations by request\n",
+		name, (double)own / ROUNDS, (double)others / ROUNDS);
+	if (errors)
+		fprintf(stderr, "%s: %u failures\n", name, errors);
+	if (own)
+		fprintf(stderr, "%s: the binding allocates on its path\n", name);
+	return errors + (own != 0);
+}
+
+/// @brief Remove a file of the temporary directory.
+static int remove_cb(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+	return remove(path);
+}
+
+int main(int argc, char** argv)
+{
+	char temp[] = "/tmp/allocs-XXXXXX";
+	char path[sizeof temp + sizeof DBFILE + 1];
+	void* frames[FRAMES];
+	const struct appid* app;
+	unsigned failures;
+
+	/* the first backtrace loads its unwinder */
+	backtrace(frames, FRAMES);
+
+	if (!mkdtemp(temp)) { perror(temp); return EXIT_DATABASE; }
+	snprintf(path, sizeof path, "%s/%s", temp, DBFILE);
+	if (xdb_open(path) || appids_init() || !(app = appids_get(APPID)))
+	{
+		nftw(temp, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+		return EXIT_DATABASE;
+	}
+	if (cache_init(2 * KEYS))
+	{
+		nftw(temp, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+		return EXIT_ALLOC;
+	}
+
+	failures = check("update", update, app);
+	failures += check("read", read_cached, app);
+	failures += check("read-uncached", read_backend, app);
+
+	nftw(temp, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+	return failures ? EXIT_CHECK : EXIT_SUCCESS;
+}
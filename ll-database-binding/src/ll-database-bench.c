@@ -0,0 +1,292 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the storage layer of the database binding.
+ *
+ * It drives xdb_put, xdb_get and xdb_delete with keys made by
+ * record_key, as the binding does, but without the binder.
+ * It loads the keys then runs a mix of reads and writes from
+ * several threads and reports the throughput and the latencies.
+ * The database is made in a new temporary directory, removed at exit
+ * with all the files of the backend (journal, log, lock...).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <ftw.h>
+#include <pthread.h>
+
+#include "xdb.h"
+#include "appids.h"
+#include "record.h"
+
+#if USE_LMDB
+# define BACKEND "lmdb"
+#elif USE_GDBM
+# define BACKEND "gdbm"
+#else
+# define BACKEND "bdb"
+#endif
+
+#define EXIT_SUCCESS		0
+#define EXIT_CMDLINE		1
+#define EXIT_DATABASE		2
+#define EXIT_ALLOC			3
+
+#define APPID				"bench-app"
+
+/// @brief Parameters of the workload.
+static const char* directory = "/tmp";
+static unsigned key_count = 10000;
+static unsigned op_count = 100000;
+static unsigned read_percent = 90;
+static unsigned value_min = 16;
+static unsigned value_max = 256;
+static unsigned thread_count = 1;
+static int sync_writes = 0;
+
+/// @brief The temporary directory of the database.
+static char temp[4096];
+
+/// @brief Per thread state and results.
+typedef struct worker_
+{
+	pthread_t tid;
+	unsigned seed;
+	unsigned count;
+	unsigned long long* latencies;
+	unsigned errors;
+} worker;
+
+static unsigned long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + (unsigned long long)ts.tv_nsec;
+}
+
+/// @brief Make the database key of the key number @c n.
+static int make_key(unsigned n, DATA* key)
+{
+	const struct appid* app;
+	char ukey[32];
+	snprintf(ukey, sizeof ukey, "key-%08u", n);
+	app = appids_get(APPID);
+	return !app || record_key(app, ukey, 1, malloc, key) ? -1 : 0;
+}
+
+/// @brief Make in @c buffer a json string value of random size, as stored by the binding.
+static void make_value(char* buffer, unsigned* seed, DATA* data)
+{
+	unsigned size = value_min + (value_max > value_min ? (unsigned)rand_r(seed) % (value_max - value_min + 1) : 0);
+	buffer[0] = '"';
+	memset(&buffer[1], 'a' + (int)(size % 26), size);
+	buffer[size + 1] = '"';
+	buffer[size + 2] = 0;
+	DATA_SET(data, buffer, size + 3);
+}
+
+/// @brief Write with the sync if requested.
+static int put(DATA* key, DATA* data)
+{
+	int r = xdb_put(key, data, 1);
+	if (!r && sync_writes)
+		r = xdb_sync();
+	return r;
+}
+
+/// @brief Run the mixed workload of one thread.
+static void* run(void* arg)
+{
+	worker* w = arg;
+	DATA key, data;
+	unsigned i, n;
+	unsigned long long start;
+	char* buffer = malloc(value_max + 3);
+
+	if (!buffer) { w->errors = w->count; return NULL; }
+	for (i = 0; i < w->count; i++)
+	{
+		n = (unsigned)rand_r(&w->seed) % key_count;
+		if (make_key(n, &key)) { w->errors++; continue; }
+		start = now_ns();
+		if ((unsigned)rand_r(&w->seed) % 100 < read_percent)
+		{
+			if (xdb_get(&key, &data)) w->errors++;
+			else xdb_release(&data);
+		}
+		else
+		{
+			make_value(buffer, &w->seed, &data);
+			if (put(&key, &data)) w->errors++;
+		}
+		w->latencies[i] = now_ns() - start;
+		free(DATA_PTR(key));
+	}
+	free(buffer);
+	return NULL;
+}
+
+static int compare_ull(const void* a, const void* b)
+{
+	unsigned long long x = *(const unsigned long long*)a, y = *(const unsigned long long*)b;
+	return x < y ? -1 : x > y;
+}
+
+/// @brief Print the results of a phase: ops/s and latency percentiles in microseconds.
+static void report(const char* phase, unsigned long long* latencies, unsigned count, unsigned long long duration, unsigned errors)
+{
+	qsort(latencies, count, sizeof *latencies, compare_ull);
+	printf("%-5s %-6s %9u ops %11.0f ops/s  p50 %8.1f  p99 %8.1f  p999 %8.1f us  %u errors\n",
+		BACKEND, phase, count,
+		duration ? (double)count * 1e9 / (double)duration : 0.0,
+		count ? (double)latencies[count / 2] / 1000 : 0.0,
+		count ? (double)latencies[(size_t)count * 99 / 100] / 1000 : 0.0,
+		count ? (double)latencies[(size_t)count * 999 / 1000] / 1000 : 0.0,
+		errors);
+}
+
+/// @brief Remove a file of the temporary directory.
+static int remove_cb(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+	return remove(path);
+}
+
+/// @brief Remove the temporary directory, at exit.
+static void remove_temp()
+{
+	nftw(temp, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d DIR     directory of the temporary directory (default /tmp)\n"
+		"  -k COUNT   count of keys (default 10000)\n"
+		"  -n COUNT   count of operations of the mix (default 100000)\n"
+		"  -r PERCENT percentage of reads in the mix (default 90)\n"
+		"  -v MIN:MAX range of the sizes of values (default 16:256)\n"
+		"  -t COUNT   count of threads (default 1)\n"
+		"  -s         sync after each write\n",
+		name);
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+	unsigned i, total, errors;
+	char path[sizeof temp + 64];
+	char* buffer;
+	unsigned long long start, duration, *latencies;
+	DATA key, data;
+	worker* workers;
+	unsigned seed = 1;
+
+	while ((opt = getopt(argc, argv, "d:k:n:r:v:t:sh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd': directory = optarg; break;
+			case 'k': key_count = (unsigned)atoi(optarg); break;
+			case 'n': op_count = (unsigned)atoi(optarg); break;
+			case 'r': read_percent = (unsigned)atoi(optarg); break;
+			case 'v':
+				if (sscanf(optarg, "%u:%u", &value_min, &value_max) == 1) value_max = value_min;
+				break;
+			case 't': thread_count = (unsigned)atoi(optarg); break;
+			case 's': sync_writes = 1; break;
+			default: usage(argv[0]); return EXIT_CMDLINE;
+		}
+	}
+	if (!key_count || !thread_count || read_percent > 100 || value_max < value_min)
+	{
+		usage(argv[0]);
+		return EXIT_CMDLINE;
+	}
+
+	snprintf(temp, sizeof temp, "%s/bench-XXXXXX", directory);
+	if (!mkdtemp(temp)) { perror(temp); return EXIT_DATABASE; }
+	atexit(remove_temp);
+	snprintf(path, sizeof path, "%s/%s", temp, DBFILE);
+	if (xdb_open(path) || appids_init()) return EXIT_DATABASE;
+
+	/* load phase: insert all the keys */
+	latencies = malloc((key_count > op_count ? key_count : op_count) * sizeof *latencies);
+	buffer = malloc(value_max + 3);
+	workers = calloc(thread_count, sizeof *workers);
+	if (!latencies || !buffer || !workers) return EXIT_ALLOC;
+
+	errors = 0;
+	start = now_ns();
+	for (i = 0; i < key_count; i++)
+	{
+		unsigned long long t = now_ns();
+		if (make_key(i, &key)) return EXIT_ALLOC;
+		make_value(buffer, &seed, &data);
+		if (put(&key, &data)) errors++;
+		free(DATA_PTR(key));
+		latencies[i] = now_ns() - t;
+	}
+	if (!sync_writes && xdb_sync()) errors++;
+	duration = now_ns() - start;
+	report("load", latencies, key_count, duration, errors);
+
+	/* mixed phase: the operations are shared by the threads */
+	total = errors = 0;
+	start = now_ns();
+	for (i = 0; i < thread_count; i++)
+	{
+		workers[i].seed = i + 2;
+		workers[i].count = op_count / thread_count + (i < op_count % thread_count);
+		workers[i].latencies = &latencies[total];
+		total += workers[i].count;
+		if (pthread_create(&workers[i].tid, NULL, run, &workers[i])) return EXIT_ALLOC;
+	}
+	for (i = 0; i < thread_count; i++)
+	{
+		pthread_join(workers[i].tid, NULL);
+		errors += workers[i].errors;
+	}
+	if (!sync_writes && read_percent < 100 && xdb_sync()) errors++;
+	duration = now_ns() - start;
+	report("mix", latencies, total, duration, errors);
+
+	/* cleanup phase: delete all the keys */
+	errors = 0;
+	start = now_ns();
+	for (i = 0; i < key_count; i++)
+	{
+		unsigned long long t = now_ns();
+		if (make_key(i, &key)) return EXIT_ALLOC;
+		if (xdb_delete(&key)) errors++;
+		free(DATA_PTR(key));
+		latencies[i] = now_ns() - t;
+	}
+	if (xdb_sync()) errors++;
+	duration = now_ns() - start;
+	report("delete", latencies, key_count, duration, errors);
+
+	free(latencies);
+	free(buffer);
+	free(workers);
+	return EXIT_SUCCESS;
+}
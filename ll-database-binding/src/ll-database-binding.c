@@ -22,241 +22,735 @@
 #include <sys/types.h>
 #include <pwd.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <json-c/json.h>
 
 #define AFB_BINDING_VERSION 2
 #include <afb/afb-binding.h>
 
-#if !defined(TO_STRING_FLAGS)
-# if !defined(JSON_C_TO_STRING_NOSLASHESCAPE)
-#  define JSON_C_TO_STRING_NOSLASHESCAPE (1<<4)
-# endif
-# define TO_STRING_FLAGS (JSON_C_TO_STRING_PLAIN | JSON_C_TO_STRING_NOSLASHESCAPE)
-#endif
+#include "xdb.h"
+#include "appids.h"
+#include "cache.h"
+#include "jobs.h"
+#include "watch.h"
+#include "metrics.h"
+#include "expiry.h"
+#include "dump.h"
+#include "scratch.h"
+#include "bloom.h"
+#include "record.h"
 
-#if defined(USE_BERKELEY_DB)
-#  undef USE_BERKELEY_DB
-#endif
+#define CACHE_SIZE_DEFAULT 256
+#define CACHE_VALUE_MAX    65536
 
-#if defined(USE_GDBM)
-#  undef USE_GDBM
-#  define USE_GDBM        1
-#  define USE_BERKELEY_DB 0
-#else
-#  define USE_GDBM        0
-#  define USE_BERKELEY_DB 1
-#endif
+#define QUEUE_DEPTH_DEFAULT 64
+#define READ_THREADS        2
+#define WRITE_THREADS       1
+
+#define COMPACT_THRESHOLD_DEFAULT 50
+#define COMPACT_INTERVAL_DEFAULT  600
+#define COMPACT_PAUSE_MS          10
+#define COMPACT_GROWTH_MIN        10
 
-// ----- Berkeley database -----
-#if USE_BERKELEY_DB
+#define EXPIRY_BATCH              32
+#define EXPIRY_PAUSE_MS           10
+
+#define BLOOM_BITS_DEFAULT        10
+#define BLOOM_FP_MAX              0.02
+#define BLOOM_STALE_MIN           1024
+
+// ----- Durability -----
+
+/*
+ * The writes are made durable by syncing the database:
+ *  - sync:  after each write or batch of writes
+ *  - group: when 'group_writes' writes are pending or 'group_delay'
+ *           milliseconds after the first pending write
+ *  - async: only by the verb 'flush' and at exit
+ */
+enum durability
+{
+	DURABILITY_SYNC,
+	DURABILITY_GROUP,
+	DURABILITY_ASYNC
+};
 
-#include <db.h>
+static const char *durability_names[] = { "sync", "group", "async" };
 
-#define DBFILE	"ll-database-binding.db"
-#define DATA	DBT
-#define DATA_SET(k,d,s)  do{memset((k),0,sizeof*(k));(k)->data=(void*)d;(k)->size=(uint32_t)s;}while(0)
-#define DATA_PTR(k)      ((void*)((k).data))
-#define DATA_STR(k)      ((char*)((k).data))
-#define DATA_SZ(k)       ((size_t)((k).size))
+static enum durability durability = DURABILITY_SYNC;
+static unsigned group_delay = 100;
+static unsigned group_writes = 100;
 
-static DB *database;
+static pthread_mutex_t sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t sync_thread;
+static unsigned pending_writes;
+static unsigned long long sync_count;
 
-static int xdb_open(const char *path)
+/**
+ * Syncs the database if writes are pending, called with sync_mutex held
+ */
+static int sync_pending()
 {
 	int ret;
 
-	ret = db_create(&database, NULL, 0);
-	if (ret != 0)
+	unsigned long long start;
+
+	if (!pending_writes)
+		return 0;
+	start = metrics_clock();
+	ret = xdb_sync();
+	metrics_backend(start, 0, 0);
+	if (ret == 0)
 	{
-		AFB_ERROR("Failed to create database: %s.", db_strerror(ret));
-		return -1;
+		pending_writes = 0;
+		sync_count++;
 	}
+	return ret;
+}
 
-	ret = database->open(database, NULL, path, NULL, DB_BTREE, DB_CREATE, 0600);
-	if (ret != 0)
+/**
+ * Syncs the pending writes now
+ */
+static int flush_writes()
+{
+	int ret;
+
+	pthread_mutex_lock(&sync_mutex);
+	ret = sync_pending();
+	pthread_mutex_unlock(&sync_mutex);
+	return ret;
+}
+
+/**
+ * Records that 'count' writes were done and makes them durable
+ * according to the durability mode
+ */
+static int commit_writes(unsigned count)
+{
+	int ret;
+
+	ret = 0;
+	pthread_mutex_lock(&sync_mutex);
+	pending_writes += count;
+	switch (durability)
 	{
-		AFB_ERROR("Failed to open the '%s' database: %s.", path, db_strerror(ret));
-		database->close(database, 0);
-		return -1;
+	case DURABILITY_SYNC:
+		ret = sync_pending();
+		break;
+	case DURABILITY_GROUP:
+		if (pending_writes >= group_writes)
+			ret = sync_pending();
+		else if (pending_writes == count)
+			pthread_cond_signal(&sync_cond);
+		break;
+	case DURABILITY_ASYNC:
+		break;
 	}
-	return 0;
+	pthread_mutex_unlock(&sync_mutex);
+	return ret;
 }
 
-static void xdb_put(struct afb_req req, DBT *key, DBT *data, int replace)
+/**
+ * Thread syncing the group of writes pending since 'group_delay' ms
+ */
+static void *group_commit_thread(void *arg)
 {
-	int ret;
+	struct timespec ts;
 
-	ret = database->put(database, NULL, key, data, replace ? 0 : DB_NOOVERWRITE);
-	if (ret == 0)
-		afb_req_success(req, NULL, NULL);
-	else
+	pthread_mutex_lock(&sync_mutex);
+	for (;;)
 	{
-		AFB_ERROR("can't %s key %s with %s", replace ? "replace" : "insert", DATA_STR(*key), DATA_STR(*data));
-		afb_req_fail_f(req, "failed", "%s", db_strerror(ret));
+		while (!pending_writes)
+			pthread_cond_wait(&sync_cond, &sync_mutex);
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += group_delay / 1000;
+		ts.tv_nsec += (long)(group_delay % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		while (pending_writes && pthread_cond_timedwait(&sync_cond, &sync_mutex, &ts) == 0);
+		sync_pending();
 	}
+	return NULL;
 }
 
-static void xdb_delete(struct afb_req req, DBT *key)
+static void flush_at_exit()
 {
-	int ret;
+	flush_writes();
+}
 
-	ret = database->del(database, NULL, key, 0);
-	if (ret == 0)
-		afb_req_success_f(req, NULL, NULL);
+/**
+ * @brief Initialize the durability from the environment variable
+ * LL_DATABASE_DURABILITY: "sync", "group[:DELAY-MS[:WRITES]]" or "async".
+ * When not set, DATABASE_DURABILITY given at build time is used.
+ */
+static int init_durability()
+{
+	const char *env;
+	int n;
+
+	env = secure_getenv("LL_DATABASE_DURABILITY");
+#if defined(DATABASE_DURABILITY)
+	if (!env)
+		env = DATABASE_DURABILITY;
+#endif
+	if (!env || !strcmp(env, "sync"))
+		durability = DURABILITY_SYNC;
+	else if (!strcmp(env, "async"))
+		durability = DURABILITY_ASYNC;
+	else if (!strncmp(env, "group", 5)
+	      && (!env[5] || (env[5] == ':'
+	          && (n = sscanf(&env[6], "%u:%u", &group_delay, &group_writes)) >= 1
+	          && group_delay && (n == 1 || group_writes))))
+		durability = DURABILITY_GROUP;
 	else
 	{
-		AFB_ERROR("can't delete key %s", DATA_STR(*key));
-		afb_req_fail_f(req, "failed", "%s", db_strerror(ret));
+		AFB_ERROR("Invalid durability: %s", env);
+		return -1;
+	}
+
+	if (durability == DURABILITY_GROUP
+	 && pthread_create(&sync_thread, NULL, group_commit_thread, NULL))
+	{
+		AFB_ERROR("Can't start the group commit thread");
+		return -1;
 	}
+	atexit(flush_at_exit);
 
-	free(DATA_PTR(key));
+	if (durability == DURABILITY_GROUP)
+		AFB_INFO("durability group, delay %ums, writes %u", group_delay, group_writes);
+	else
+		AFB_INFO("durability %s", durability_names[durability]);
+	return 0;
 }
 
-static void verb_read(struct afb_req req)
+// ----- Write lock -----
+
+/*
+ * The writes are serialized, so that the verbs that read the current
+ * value before writing (insert, cas, incr, merge, transaction...) and
+ * the expiry are atomic. The reads take no lock: they are never blocked
+ * by the writes and the cache keeps them coherent by its stamps. The
+ * writers update the cache after the backend, the readers take the
+ * stamp before it.
+ */
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// ----- Compaction -----
+
+/*
+ * A background thread measures the free space of the database file
+ * every 'compact_interval' seconds. It checkpoints the log of the
+ * backend at the same pace, whatever the durability, so that the old
+ * log files are removed even if the database is never synced. It
+ * compacts the file when the free space reaches 'compact_threshold'
+ * percent of the file, unless the file grew by less than
+ * COMPACT_GROWTH_MIN percent since the last compaction: the estimate of
+ * the free space may be wrong and the compaction would then be vain
+ * again, wearing the flash.
+ * The compaction goes by small steps separated by pauses of
+ * COMPACT_PAUSE_MS so that the other accesses go on meanwhile.
+ * The verb 'compact' requests a compaction now.
+ */
+static pthread_mutex_t compact_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compact_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t compact_thread;
+static unsigned compact_threshold = COMPACT_THRESHOLD_DEFAULT;
+static unsigned compact_interval = COMPACT_INTERVAL_DEFAULT;
+static int compact_requested;
+static int compacting;
+static struct xdb_usage usage;
+static unsigned long long compacted_size;
+static unsigned long long compact_count;
+static unsigned long long reclaimed;
+
+static int compact_throttle(void *closure)
 {
-	DATA key;
-	DATA data;
-	int ret;
+	struct timespec ts;
 
-	char value[4096];
+	ts.tv_sec = 0;
+	ts.tv_nsec = COMPACT_PAUSE_MS * 1000000L;
+	nanosleep(&ts, NULL);
+	return 0;
+}
 
-	struct json_object* result;
-	struct json_object* val;
+/* measures the usage of the database, called with compact_mutex held */
+static void measure_usage()
+{
+	struct xdb_usage measure;
 
+	pthread_mutex_unlock(&compact_mutex);
+	if (xdb_usage(&measure) != 0)
+		measure = usage;
+	pthread_mutex_lock(&compact_mutex);
+	usage = measure;
+}
 
-	if (get_key(req, &key))
-		return;
+static void *compaction_thread(void *arg)
+{
+	struct timespec ts;
+	unsigned long long before;
+	int ret;
 
-	AFB_INFO("read: key=%s", DATA_STR(key));
+	pthread_mutex_lock(&compact_mutex);
+	for (;;)
+	{
+		pthread_mutex_unlock(&compact_mutex);
+		xdb_checkpoint();
+		pthread_mutex_lock(&compact_mutex);
+		measure_usage();
+		if (XDB_CAN_COMPACT
+		 && (compact_requested
+		  || (compact_threshold
+		   && usage.free_size * 100 >= usage.file_size * compact_threshold
+		   && usage.file_size * 100 >= compacted_size * (100 + COMPACT_GROWTH_MIN))))
+		{
+			AFB_INFO("compacting, size %llu, free %llu", usage.file_size, usage.free_size);
+			before = usage.file_size;
+			compacting = 1;
+			compact_requested = 0;
+			pthread_mutex_unlock(&compact_mutex);
+			ret = xdb_compact(compact_throttle, NULL);
+			pthread_mutex_lock(&compact_mutex);
+			compacting = 0;
+			measure_usage();
+			compacted_size = usage.file_size;
+			if (ret == 0)
+			{
+				compact_count++;
+				if (before > usage.file_size)
+					reclaimed += before - usage.file_size;
+			}
+		}
 
-	memset(&data, 0, sizeof data);
-	data.data = value;
-	data.ulen = 4096;
-	data.flags = DB_DBT_USERMEM;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += compact_interval;
+		while (!compact_requested && pthread_cond_timedwait(&compact_cond, &compact_mutex, &ts) == 0);
+	}
+	return NULL;
+}
 
-	ret = database->get(database, NULL, &key, &data, 0);
-	if (ret == 0)
+/**
+ * @brief Initialize the compaction from the environment variable
+ * LL_DATABASE_COMPACT: "off" or "THRESHOLD-PERCENT[:INTERVAL-S]".
+ * With "off" the compaction is only made by the verb 'compact'.
+ */
+static int init_compaction()
+{
+	const char *env;
+	int n;
+
+	env = secure_getenv("LL_DATABASE_COMPACT");
+	if (env && !strcmp(env, "off"))
+		compact_threshold = 0;
+	else if (env
+	      && ((n = sscanf(env, "%u:%u", &compact_threshold, &compact_interval)) < 1
+	       || !compact_threshold || compact_threshold > 100 || (n == 2 && !compact_interval)))
 	{
-		result = json_object_new_object();
-		val = json_tokener_parse(DATA_STR(data));
-		json_object_object_add(result, "value", val ? val : json_object_new_string(DATA_STR(data)));
+		AFB_ERROR("Invalid LL_DATABASE_COMPACT: %s", env);
+		return -1;
+	}
 
-		afb_req_success_f(req, result, "db success: read %s=%s.", DATA_STR(key), DATA_STR(data));
+	if (pthread_create(&compact_thread, NULL, compaction_thread, NULL))
+	{
+		AFB_ERROR("Can't start the compaction thread");
+		return -1;
 	}
-	else
-		afb_req_fail_f(req, "Failed to read datas.", "db fail: read %s - %s", DATA_STR(key), db_strerror(ret));
+	return 0;
+}
+
+// ----- Bloom filter -----
+
+/*
+ * A Bloom filter of the keys of the database answers that a key doesn't
+ * exist without asking the backend. It is built at start and the writes
+ * add their keys. As a key can't be removed from a Bloom filter, the
+ * removals are only counted: when they reach half of the keys, or when
+ * the added keys push the rate of false positives over BLOOM_FP_MAX, a
+ * thread builds a new filter from the keys of the database. The writes
+ * made meanwhile add their keys to both filters and the new filter
+ * replaces the old one. The filters are only used with 'bloom_lock'
+ * held for reading, the replacement holds it for writing: as the bits
+ * are set and tested atomically, the readers and the writers share it.
+ */
+static pthread_rwlock_t bloom_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t bloom_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bloom_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t bloom_thread;
+static unsigned bloom_bits_per_key = BLOOM_BITS_DEFAULT;
+static struct bloom *bloom;		/* the filter or NULL */
+static struct bloom *bloom_next;	/* the filter being built or NULL */
+static int bloom_requested;
+static size_t bloom_keys;		/* count of keys when built */
+static size_t bloom_removed;		/* count of keys removed since */
+static unsigned long long bloom_negatives;
+static unsigned long long bloom_false_positives;
+static unsigned long long bloom_builds;
+
+static void bloom_request()
+{
+	pthread_mutex_lock(&bloom_mutex);
+	bloom_requested = 1;
+	pthread_cond_signal(&bloom_cond);
+	pthread_mutex_unlock(&bloom_mutex);
+}
+
+/**
+ * Adds 'key' to the filter, with the write lock held
+ */
+static void bloom_add_key(DATA *key)
+{
+	struct bloom_stats stats;
 
-	free(DATA_PTR(key));
+	pthread_rwlock_rdlock(&bloom_lock);
+	if (bloom_next)
+		bloom_add(bloom_next, DATA_PTR(*key), DATA_SZ(*key));
+	if (bloom && bloom_add(bloom, DATA_PTR(*key), DATA_SZ(*key)) && !bloom_next)
+	{
+		bloom_get_stats(bloom, &stats);
+		if (stats.fp_rate > BLOOM_FP_MAX)
+			bloom_request();
+	}
+	pthread_rwlock_unlock(&bloom_lock);
 }
 
-#endif
+/**
+ * Counts the removal of a key, with the write lock held
+ */
+static void bloom_remove_key()
+{
+	pthread_rwlock_rdlock(&bloom_lock);
+	if (bloom && !bloom_next && ++bloom_removed == bloom_keys / 2 + BLOOM_STALE_MIN)
+		bloom_request();
+	pthread_rwlock_unlock(&bloom_lock);
+}
 
-// ----- gdbm database -----
-#if USE_GDBM
+/**
+ * Tells whether 'key' may exist, without counting the answer
+ */
+static int bloom_test_key(DATA *key)
+{
+	int ret;
 
-#include <errno.h>
-#include <gdbm.h>
+	pthread_rwlock_rdlock(&bloom_lock);
+	ret = !bloom || bloom_test(bloom, DATA_PTR(*key), DATA_SZ(*key));
+	pthread_rwlock_unlock(&bloom_lock);
+	return ret;
+}
 
-#define DBFILE	"ll-database-binding.dbm"
-#define DATA	datum
-#define DATA_SET(k,d,s)  do{(k)->dptr=(char*)d;(k)->dsize=(int)s;}while(0)
-#define DATA_PTR(k)      ((void*)((k).dptr))
-#define DATA_STR(k)      ((char*)((k).dptr))
-#define DATA_SZ(k)       ((size_t)((k).dsize))
+/**
+ * Tells whether 'key' may exist, counting the lookups that the filter
+ * saved
+ */
+static int bloom_may_exist(DATA *key)
+{
+	if (bloom_test_key(key))
+		return 1;
+	__atomic_add_fetch(&bloom_negatives, 1, __ATOMIC_RELAXED);
+	return 0;
+}
 
-#if GDBM_VERSION_MAJOR > 1 || (GDBM_VERSION_MAJOR == 1 && GDBM_VERSION_MINOR >= 13)
-# define IFSYS(yes,no)   (gdbm_syserr[gdbm_errno] ? (yes) : (no))
-#else
-# define IFSYS(yes,no)   (no)
-#endif
+/**
+ * Counts a key that the filter didn't exclude but that doesn't exist
+ */
+static void bloom_false_positive()
+{
+	if (__atomic_load_n(&bloom, __ATOMIC_RELAXED))
+		__atomic_add_fetch(&bloom_false_positives, 1, __ATOMIC_RELAXED);
+}
 
-static GDBM_FILE database;
+static int bloom_count_cb(void *closure, DATA *key, DATA *data)
+{
+	(*(size_t*)closure)++;
+	return 0;
+}
 
-static void onfatal(const char *text)
+static int bloom_fill_cb(void *closure, DATA *key, DATA *data)
 {
-	AFB_ERROR("fatal gdbm message: %s", text);
+	bloom_add(closure, DATA_PTR(*key), DATA_SZ(*key));
+	return 0;
 }
 
-static int xdb_open(const char *path)
+/**
+ * Builds the filter from the keys of the database
+ * Returns 0 or -1 on error
+ */
+static int build_bloom()
 {
-	database = gdbm_open(path, 512, GDBM_WRCREAT|GDBM_SYNC, 0600, onfatal);
-	if (!database)
+	struct bloom *next;
+	size_t count;
+	DATA all;
+	int ret;
+
+	/* the filter is sized for the current keys and as much again */
+	count = 0;
+	DATA_SET(&all, "", 0);
+	ret = xdb_scan(&all, &all, 0, bloom_count_cb, &count);
+	next = ret ? NULL : bloom_create(2 * count, bloom_bits_per_key);
+	if (!next)
+		return -1;
+
+	/* from now the writes add their keys to the new filter too */
+	pthread_rwlock_wrlock(&bloom_lock);
+	bloom_next = next;
+	bloom_keys = count;
+	bloom_removed = 0;
+	pthread_rwlock_unlock(&bloom_lock);
+
+	ret = xdb_scan(&all, &all, 0, bloom_fill_cb, next);
+
+	pthread_rwlock_wrlock(&bloom_lock);
+	bloom_next = NULL;
+	if (ret == 0)
+	{
+		bloom_destroy(bloom);
+		__atomic_store_n(&bloom, next, __ATOMIC_RELAXED);
+	}
+	pthread_rwlock_unlock(&bloom_lock);
+	if (ret != 0)
 	{
-		AFB_ERROR("Fail to open/create database: %s%s%s",
-			gdbm_errlist[gdbm_errno],
-			IFSYS(", ", ""),
-			IFSYS(strerror(errno), ""));
+		bloom_destroy(next);
 		return -1;
-		
 	}
+	__atomic_add_fetch(&bloom_builds, 1, __ATOMIC_RELAXED);
+	AFB_INFO("bloom filter built for %zu key(s)", count);
 	return 0;
 }
 
-static void xdb_put(struct afb_req req, datum *key, datum *data, int replace)
+static void *bloom_thread_main(void *arg)
 {
-	int ret;
+	pthread_mutex_lock(&bloom_mutex);
+	for (;;)
+	{
+		while (!bloom_requested)
+			pthread_cond_wait(&bloom_cond, &bloom_mutex);
+		bloom_requested = 0;
+		pthread_mutex_unlock(&bloom_mutex);
+		if (build_bloom())
+			AFB_ERROR("can't rebuild the bloom filter");
+		pthread_mutex_lock(&bloom_mutex);
+	}
+	return NULL;
+}
 
-	ret = gdbm_store(database, *key, *data, replace ? GDBM_REPLACE : GDBM_INSERT);
-	if (ret == 0)
-		afb_req_success(req, NULL, NULL);
-	else
+/**
+ * Returns the statistics of the filter as a json object
+ */
+static struct json_object *bloom_stats_json()
+{
+	struct bloom_stats stats;
+	struct json_object *result;
+	unsigned long long negatives, positives;
+	int enabled;
+
+	result = json_object_new_object();
+	pthread_rwlock_rdlock(&bloom_lock);
+	enabled = bloom != NULL;
+	if (enabled)
+		bloom_get_stats(bloom, &stats);
+	json_object_object_add(result, "enabled", json_object_new_boolean(enabled));
+	json_object_object_add(result, "removed", json_object_new_int64((int64_t)bloom_removed));
+	pthread_rwlock_unlock(&bloom_lock);
+	if (!enabled)
+		return result;
+
+	negatives = __atomic_load_n(&bloom_negatives, __ATOMIC_RELAXED);
+	positives = __atomic_load_n(&bloom_false_positives, __ATOMIC_RELAXED);
+	json_object_object_add(result, "bits", json_object_new_int64((int64_t)stats.bits));
+	json_object_object_add(result, "hashes", json_object_new_int64((int64_t)stats.hashes));
+	json_object_object_add(result, "fill", json_object_new_int64((int64_t)(stats.set * 100 / stats.bits)));
+	json_object_object_add(result, "fp-rate", json_object_new_double(stats.fp_rate));
+	json_object_object_add(result, "fp-rate-observed", json_object_new_double(negatives + positives ? (double)positives / (double)(negatives + positives) : 0.0));
+	json_object_object_add(result, "negatives", json_object_new_int64((int64_t)negatives));
+	json_object_object_add(result, "false-positives", json_object_new_int64((int64_t)positives));
+	json_object_object_add(result, "builds", json_object_new_int64((int64_t)__atomic_load_n(&bloom_builds, __ATOMIC_RELAXED)));
+	return result;
+}
+
+/**
+ * @brief Build the Bloom filter, configured by the environment variable
+ * LL_DATABASE_BLOOM: "off" or the count of bits by key.
+ */
+static int init_bloom()
+{
+	const char *env;
+	char *end;
+
+	env = secure_getenv("LL_DATABASE_BLOOM");
+	if (env && !strcmp(env, "off"))
+		return 0;
+	if (env)
+	{
+		bloom_bits_per_key = (unsigned)strtoul(env, &end, 10);
+		if (*end || end == env || !bloom_bits_per_key || bloom_bits_per_key > 64)
+		{
+			AFB_ERROR("Invalid LL_DATABASE_BLOOM: %s", env);
+			return -1;
+		}
+	}
+
+	if (build_bloom())
+	{
+		AFB_ERROR("Can't build the bloom filter");
+		return -1;
+	}
+	if (pthread_create(&bloom_thread, NULL, bloom_thread_main, NULL))
 	{
-		AFB_ERROR("can't %s key %s with %s: %s%s%s",
-			replace ? "replace" : "insert",
-			DATA_STR(*key),
-			DATA_STR(*data),
-			gdbm_errlist[gdbm_errno],
-			IFSYS(", ", ""),
-			IFSYS(strerror(errno), ""));
-		afb_req_fail_f(req, "failed", "%s", ret > 0 ? "key already exists" : gdbm_errlist[gdbm_errno]);
+		AFB_ERROR("Can't start the bloom filter thread");
+		return -1;
 	}
+	return 0;
 }
 
-static void xdb_delete(struct afb_req req, datum *key)
+// ----- Metrics -----
+
+/*
+ * The verbs are counted by their callbacks, their failures by the
+ * functions below and the calls to the backend where they are made.
+ * The counters of a verb are those of the thread that runs it: an
+ * offloaded verb is followed by the worker thread.
+ */
+
+/**
+ * Replies the failure 'status' of 'req' and counts it
+ */
+static void fail(struct afb_req req, const char *status, const char *info)
 {
-	int ret;
+	metrics_fail(status);
+	afb_req_fail(req, status, info);
+}
 
-	ret = gdbm_delete(database, *key);
-	if (ret == 0)
-		afb_req_success_f(req, NULL, NULL);
-	else
+/**
+ * Replies the failure 'status' of 'req', with a formatted info, and counts it
+ */
+static void fail_f(struct afb_req req, const char *status, const char *info, ...)
+{
+	va_list args;
+
+	metrics_fail(status);
+	va_start(args, info);
+	afb_req_fail_v(req, status, info, args);
+	va_end(args);
+}
+
+// ----- Offloading -----
+
+/*
+ * The verbs that may wait for the disk are not run by the thread of the
+ * binder that received them but by a pool of threads: the writes, that
+ * may sync, by the write queue and the long reads by the read queue.
+ * When a queue is full the request fails with "busy". The jobs are
+ * recycled: the pool has at most as many jobs as were ever pending.
+ */
+static struct jobs *read_jobs;
+static struct jobs *write_jobs;
+
+struct offloaded
+{
+	struct offloaded *next;
+	struct afb_req req;
+	void (*verb)(struct afb_req);
+	int metric;
+};
+
+static pthread_mutex_t offloaded_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct offloaded *offloaded_pool;
+
+static struct offloaded *offloaded_get()
+{
+	struct offloaded *job;
+
+	pthread_mutex_lock(&offloaded_mutex);
+	job = offloaded_pool;
+	if (job)
+		offloaded_pool = job->next;
+	pthread_mutex_unlock(&offloaded_mutex);
+	return job ?: malloc(sizeof *job);
+}
+
+static void offloaded_put(struct offloaded *job)
+{
+	pthread_mutex_lock(&offloaded_mutex);
+	job->next = offloaded_pool;
+	offloaded_pool = job;
+	pthread_mutex_unlock(&offloaded_mutex);
+}
+
+static void offloaded_run(void *closure)
+{
+	struct offloaded *job = closure;
+
+	scratch_reset();
+	metrics_enter(job->metric);
+	job->verb(job->req);
+	afb_req_unref(job->req);
+	offloaded_put(job);
+}
+
+static void offload(struct afb_req req, struct jobs *jobs, void (*verb)(struct afb_req))
+{
+	struct offloaded *job;
+
+	job = offloaded_get();
+	if (!job)
 	{
-		AFB_ERROR("can't delete key %s: %s%s%s",
-			DATA_STR(*key),
-			gdbm_errlist[gdbm_errno],
-			IFSYS(", ", ""),
-			IFSYS(strerror(errno), ""));
-		afb_req_fail_f(req, "failed", "%s", gdbm_errlist[gdbm_errno]);
+		fail(req, "out-of-memory", NULL);
+		return;
+	}
+	job->req = req;
+	job->verb = verb;
+	job->metric = metrics_current();
+	afb_req_addref(req);
+	if (jobs_queue(jobs, offloaded_run, job) < 0)
+	{
+		afb_req_unref(req);
+		offloaded_put(job);
+		fail_f(req, "busy", "the %s queue is full", jobs_name(jobs));
 	}
 }
 
-static void xdb_get(struct afb_req req, datum *key)
+/**
+ * @brief Initialize the queues, their depth is given by the environment
+ * variable LL_DATABASE_QUEUE_DEPTH.
+ */
+static int init_jobs()
 {
-	struct json_object* obj;
-	datum result;
+	const char *env;
+	char *end;
+	size_t depth;
 
-	result = gdbm_fetch(database, *key);
-	if (result.dptr)
+	depth = QUEUE_DEPTH_DEFAULT;
+	env = secure_getenv("LL_DATABASE_QUEUE_DEPTH");
+	if (env)
 	{
-		obj = json_object_new_object();
-		json_object_object_add(obj, "value", json_tokener_parse(result.dptr));
-		afb_req_success(req, obj, NULL);
-		free(result.dptr);
+		depth = (size_t)strtoul(env, &end, 10);
+		if (*end || end == env || !depth)
+		{
+			AFB_ERROR("Invalid LL_DATABASE_QUEUE_DEPTH: %s", env);
+			return -1;
+		}
 	}
-	else
+
+	read_jobs = jobs_create("read", READ_THREADS, depth);
+	write_jobs = jobs_create("write", WRITE_THREADS, depth);
+	if (!read_jobs || !write_jobs)
 	{
-		AFB_ERROR("can't get key %s: %s%s%s",
-			DATA_STR(*key),
-			gdbm_errlist[gdbm_errno],
-			IFSYS(", ", ""),
-			IFSYS(strerror(errno), ""));
-		afb_req_fail_f(req, "failed", "%s", gdbm_errlist[gdbm_errno]);
+		AFB_ERROR("Can't create the queues");
+		return -1;
 	}
+	return 0;
 }
-#endif
 
 // ----- Binding's implementations -----
 
@@ -292,89 +786,361 @@ static int get_database_path(char *buffer, size_t size)
 }
 
 /**
- * @brief Initialize the binding.
- * @return Exit code, zero if success.
+ * @brief Initialize the cache of values, its size is given by the
+ * environment variable LL_DATABASE_CACHE_SIZE (zero disables it).
  */
-static int ll_database_binding_init()
+static int init_cache()
 {
-	char path[PATH_MAX];
-	int ret;
+	const char *env;
+	char *end;
+	size_t size;
 
-	ret = get_database_path(path, sizeof path);
-	if (ret < 0 || (int)ret >=  (int)(sizeof path))
+	size = CACHE_SIZE_DEFAULT;
+	env = secure_getenv("LL_DATABASE_CACHE_SIZE");
+	if (env)
 	{
-		AFB_ERROR("Can't compute the database filename");
-		return -1;
+		size = (size_t)strtoul(env, &end, 10);
+		if (*end || end == env)
+		{
+			AFB_ERROR("Invalid LL_DATABASE_CACHE_SIZE: %s", env);
+			return -1;
+		}
 	}
 
-	AFB_INFO("opening database %s", path);
-	return xdb_open(path);
+	AFB_INFO("cache size %zu", size);
+	if (cache_init(size) < 0)
+	{
+		AFB_ERROR("Can't allocate the cache");
+		return -1;
+	}
+	return 0;
 }
 
 /**
- * Returns the database key for the 'req'
+ * Returns the application id of 'req' or NULL after replying the failure
  */
-static int get_key(struct afb_req req, DATA *key)
+static char *get_appid(struct afb_req req)
 {
-	char *appid, *data;
-	const char *jkey;
-
-	size_t ljkey, lappid, size;
-
-	struct json_object* args;
-	struct json_object* item;
-
-	/* get the key */
-	args = afb_req_json(req);
-	if (!json_object_object_get_ex(args, "key", &item))
-	{
-		afb_req_fail(req, "no-key", NULL);
-		return -1;
-	}
-	if (!item
-	 || !(jkey = json_object_get_string(item))
-	 || !(ljkey = strlen(jkey)))
-	{
-		afb_req_fail(req, "bad-key", NULL);
-		return -1;
-	}
+	char *appid;
 
-	/* get the appid */
 	appid = afb_req_get_application_id(req);
 #if 1
 	if (!appid)
 		appid = strdup("#UNKNOWN-APP#");
 #endif
 	if (!appid)
-	{
-		afb_req_fail(req, "bad-context", NULL);
-		return -1;
-	}
+		fail(req, "bad-context", NULL);
+	return appid;
+}
 
-	/* make the db-key */
-	lappid = strlen(appid);
-	size = lappid + ljkey + 2;
-	data = realloc(appid, size);
-	if (!data)
+/**
+ * Returns the application of 'req' or NULL after replying the failure.
+ * It is resolved from the credentials of each request: the session can
+ * be joined by other clients, it must not carry the key namespace. The
+ * number of a known application is found in the hash of the dictionary.
+ */
+static const struct appid *get_app(struct afb_req req)
+{
+	const struct appid *app;
+	char *appid;
+
+	appid = get_appid(req);
+	if (!appid)
+		return NULL;
+	app = appids_get(appid);
+	free(appid);
+	if (!app)
+	{
+		fail(req, "failed", "can't number the application");
+		return NULL;
+	}
+	return app;
+}
+
+/**
+ * Makes in 'key' the database key of 'item' for the application 'app'
+ * Returns NULL on success or the error code
+ */
+static const char *make_key(const struct appid *app, struct json_object *item, DATA *key)
+{
+	const char *jkey;
+
+	if (!item
+	 || !(jkey = json_object_get_string(item))
+	 || !*jkey)
+		return "bad-key";
+
+	/* make the db-key, it includes the tailing null */
+	return record_key(app, jkey, 1, scratch_alloc, key);
+}
+
+/**
+ * Returns the offset of the key of the application in the database 'key'
+ */
+static size_t key_skip(DATA *key)
+{
+	return appids_skip(DATA_PTR(*key), DATA_SZ(*key));
+}
+
+/* the arguments of the format "%s:%s" printing the database 'key' */
+#define KEY_LOG(key)	(appids_name(DATA_PTR(key), DATA_SZ(key)) ?: "?"), &DATA_STR(key)[key_skip(&(key))]
+
+/**
+ * Returns the database key for the 'req'
+ */
+static int get_key(struct afb_req req, DATA *key)
+{
+	const struct appid *app;
+	const char *error;
+
+	struct json_object* args;
+	struct json_object* item;
+
+	/* get the key */
+	args = afb_req_json(req);
+	if (!json_object_object_get_ex(args, "key", &item))
 	{
-		free(appid);
-		afb_req_fail(req, "out-of-memory", NULL);
+		fail(req, "no-key", NULL);
 		return -1;
 	}
-	data[lappid] = ':';
-	memcpy(&data[lappid + 1], jkey, ljkey + 1);
 
-	/* return the key */
-	DATA_SET(key, data, size);
+	/* get the application */
+	app = get_app(req);
+	if (!app)
+		return -1;
+
+	/* make the db-key */
+	error = make_key(app, item, key);
+	if (error)
+	{
+		fail(req, error, NULL);
+		return -1;
+	}
 	return 0;
 }
 
+/**
+ * Tells if 'expiry' is past
+ */
+static int is_expired(time_t expiry)
+{
+	return expiry && expiry <= time(NULL);
+}
+
+/**
+ * Returns the json value of the stored 'data'
+ */
+static struct json_object *get_value(DATA *data)
+{
+	struct json_object* value;
+	const char* text;
+
+	text = record_text(data);
+	value = json_tokener_parse(text);
+	return value ? value : json_object_new_string(text);
+}
+
+/*
+ * A raw value is a json object that prints the stored text of the value
+ * as is: it spares the parse of the text and its print in the reply.
+ */
+struct raw
+{
+	int length;		/* length of the text */
+	char text[];		/* the json text */
+};
+
+static int raw_print(struct json_object *jso, struct printbuf *pb, int level, int flags)
+{
+	struct raw *raw = json_object_get_userdata(jso);
+
+	return printbuf_memappend(pb, raw->text, raw->length);
+}
+
+static void raw_free(struct json_object *jso, void *userdata)
+{
+	free(userdata);
+}
+
+/**
+ * Returns the raw json value of the stored 'data' or NULL if out of memory
+ */
+static struct json_object *get_raw_value(DATA *data)
+{
+	struct json_object* value;
+	struct raw* raw;
+	const char* text;
+	size_t length;
+
+	/* the text is followed by a null that isn't part of it */
+	text = record_text(data);
+	length = DATA_SZ(*data) - (size_t)(text - DATA_STR(*data)) - 1;
+	raw = length > INT_MAX ? NULL : malloc(sizeof *raw + length);
+	value = raw ? json_object_new_object() : NULL;
+	if (!value)
+	{
+		free(raw);
+		return NULL;
+	}
+	raw->length = (int)length;
+	memcpy(raw->text, text, length);
+	json_object_set_serializer(value, raw_print, raw, raw_free);
+	return value;
+}
+
+/**
+ * Gets in 'expiry' the expiry time of the value of 'key' or zero
+ */
+static int read_expiry(DATA *key, time_t *expiry)
+{
+	DATA data;
+	size_t size;
+	int ret;
+	unsigned long long start;
+
+	start = metrics_clock();
+	ret = xdb_get_part(key, 0, RECORD_EXPIRY_HEADER, &data, &size);
+	metrics_backend(start, ret ? 0 : DATA_SZ(data), 0);
+	if (ret == 0)
+	{
+		*expiry = record_expiry(&data);
+		xdb_release(&data);
+	}
+	return ret;
+}
+
+/**
+ * Gets in 'expiry' the expiry time given by the optional 'ttl' of 'args'
+ * in seconds, zero if there is no ttl
+ * Returns NULL on success or the error code
+ */
+static const char *get_expiry(struct json_object *args, time_t *expiry)
+{
+	struct json_object* item;
+	int64_t ttl;
+
+	*expiry = 0;
+	if (!json_object_object_get_ex(args, "ttl", &item))
+		return NULL;
+
+	ttl = json_object_get_int64(item);
+	if (!json_object_is_type(item, json_type_int) || ttl <= 0)
+		return "bad-ttl";
+	*expiry = time(NULL) + (time_t)ttl;
+	return NULL;
+}
+
+/**
+ * Reads in 'value' the json value of 'key', from the cache when possible.
+ * When 'raw' is set and the value isn't in the cache, 'value' is its raw
+ * value, that isn't cached.
+ */
+static int read_value(DATA *key, struct json_object **value, int raw)
+{
+	DATA data;
+	int ret;
+	time_t expiry;
+	unsigned stamp;
+	unsigned long long start;
+
+	*value = cache_get(DATA_PTR(*key), DATA_SZ(*key), NULL);
+	if (*value)
+		return 0;
+
+	stamp = cache_stamp(DATA_PTR(*key), DATA_SZ(*key));
+	if (!bloom_may_exist(key))
+		ret = XDB_NOTFOUND;
+	else
+	{
+		start = metrics_clock();
+		ret = xdb_get(key, &data);
+		metrics_backend(start, ret ? 0 : DATA_SZ(data), 0);
+		if (ret == XDB_NOTFOUND)
+			bloom_false_positive();
+	}
+	if (ret == 0)
+	{
+		/* an expired value not yet removed is missing */
+		expiry = record_expiry(&data);
+		if (is_expired(expiry))
+			ret = XDB_NOTFOUND;
+		else if (!raw || !(*value = get_raw_value(&data)))
+		{
+			*value = get_value(&data);
+			if (DATA_SZ(data) <= CACHE_VALUE_MAX)
+				cache_fill(DATA_PTR(*key), DATA_SZ(*key), *value, expiry, stamp);
+		}
+		xdb_release(&data);
+	}
+	return ret;
+}
+
+/**
+ * Writes for 'key' the 'data' made from 'value'
+ */
+static int write_value(DATA *key, DATA *data, struct json_object *value, int replace)
+{
+	int ret;
+	time_t expiry;
+	unsigned long long start;
+
+	pthread_mutex_lock(&write_lock);
+	start = metrics_clock();
+	/* a key surely missing is written without looking for it, which
+	 * isn't a read saved: the negatives of the filter don't count it */
+	ret = xdb_put(key, data, replace || !bloom_test_key(key));
+	/* an expired value not yet removed doesn't prevent an insertion */
+	if (ret == XDB_KEYEXIST && !replace && read_expiry(key, &expiry) == 0 && is_expired(expiry))
+		ret = xdb_put(key, data, 1);
+	metrics_backend(start, 0, ret ? 0 : DATA_SZ(*key) + DATA_SZ(*data));
+	if (ret == 0)
+	{
+		bloom_add_key(key);
+		expiry = record_expiry(data);
+		if (expiry && expiry_add(DATA_PTR(*key), DATA_SZ(*key), expiry) < 0)
+			AFB_ERROR("can't index the expiry of %s:%s", KEY_LOG(*key));
+
+		/* large values are not kept in memory */
+		if (DATA_SZ(*data) <= CACHE_VALUE_MAX)
+			cache_set(DATA_PTR(*key), DATA_SZ(*key), value, expiry);
+		else
+			cache_drop(DATA_PTR(*key), DATA_SZ(*key));
+		watch_notify(DATA_PTR(*key), DATA_SZ(*key), key_skip(key), replace ? "update" : "insert", value);
+	}
+	pthread_mutex_unlock(&write_lock);
+	return ret;
+}
+
+/**
+ * Removes the value of 'key'
+ */
+static int remove_value(DATA *key)
+{
+	int ret;
+	unsigned long long start;
+
+	pthread_mutex_lock(&write_lock);
+	start = metrics_clock();
+	ret = xdb_delete(key);
+	metrics_backend(start, 0, 0);
+	cache_drop(DATA_PTR(*key), DATA_SZ(*key));
+	if (ret == 0)
+	{
+		bloom_remove_key();
+		watch_notify(DATA_PTR(*key), DATA_SZ(*key), key_skip(key), "delete", NULL);
+	}
+	pthread_mutex_unlock(&write_lock);
+	return ret;
+}
+
 static void put(struct afb_req req, int replace)
 {
 	DATA key;
 	DATA data;
+	time_t expiry;
 
-	const char* value;
+	const char* error;
+	int ret;
 
 	struct json_object* args;
 	struct json_object* item;
@@ -383,24 +1149,28 @@ static void put(struct afb_req req, int replace)
 	args = afb_req_json(req);
 	if (!json_object_object_get_ex(args, "value", &item))
 	{
-		afb_req_fail(req, "no-value", NULL);
+		fail(req, "no-value", NULL);
 		return;
 	}
-	value = json_object_to_json_string_ext(item, TO_STRING_FLAGS);
-	if (!value)
+	error = get_expiry(args, &expiry) ?: record_value(item, expiry, &data);
+	if (error)
 	{
-		afb_req_fail(req, "out-of-memory", NULL);
+		fail(req, error, NULL);
 		return;
 	}
-	DATA_SET(&data, value, strlen(value) + 1); /* includes the tailing null */
 
 	/* get the key */
 	if (get_key(req, &key))
 		return;
 
-	AFB_INFO("put: key=%s, value=%s", DATA_STR(key), DATA_STR(data));
-	xdb_put(req, &key, &data, replace);
-	free(DATA_PTR(key));
+	AFB_INFO("put: key=%s:%s, value=%s", KEY_LOG(key), record_text(&data));
+	ret = write_value(&key, &data, item, replace);
+	if (ret == 0)
+		ret = commit_writes(1);
+	if (ret == 0)
+		afb_req_success(req, NULL, NULL);
+	else
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
 }
 
 static void verb_insert(struct afb_req req)
@@ -416,45 +1186,1717 @@ static void verb_update(struct afb_req req)
 static void verb_delete(struct afb_req req)
 {
 	DATA key;
+	int ret;
+
+	if (get_key(req, &key))
+		return;
+
+	AFB_INFO("delete: key=%s:%s", KEY_LOG(key));
+	ret = remove_value(&key);
+	if (ret == 0)
+		ret = commit_writes(1);
+	if (ret == 0)
+		afb_req_success(req, NULL, NULL);
+	else
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
+}
+
+/**
+ * Reads the part of the value of 'key' given by 'offset' and 'length'.
+ * The part is a piece of the json text of the value.
+ */
+static void read_part(struct afb_req req, DATA *key, struct json_object *offset, struct json_object *length)
+{
+	DATA data;
+	int ret;
+	int64_t off, len;
+	size_t size, lpart, skip;
+	time_t expiry;
+	unsigned long long start;
+
+	struct json_object* result;
+
+	off = offset ? json_object_get_int64(offset) : 0;
+	len = length ? json_object_get_int64(length) : INT64_MAX;
+	if (off < 0 || len < 0)
+	{
+		fail(req, "bad-range", NULL);
+		return;
+	}
+
+	AFB_INFO("read: key=%s:%s, offset=%lld, length=%lld", KEY_LOG(*key), (long long)off, (long long)len);
+	/* the offset is in the json text, after the header if any */
+	ret = read_expiry(key, &expiry);
+	if (ret == 0 && is_expired(expiry))
+		ret = XDB_NOTFOUND;
+	skip = expiry ? RECORD_EXPIRY_HEADER : 0;
+	if (ret == 0)
+	{
+		start = metrics_clock();
+		ret = xdb_get_part(key, (size_t)off + skip, len > SIZE_MAX ? SIZE_MAX : (size_t)len, &data, &size);
+		metrics_backend(start, ret ? 0 : DATA_SZ(data), 0);
+	}
+	if (ret != 0)
+	{
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
+		return;
+	}
+
+	/* the tailing null isn't part of the text */
+	size -= skip + 1;
+	lpart = DATA_SZ(data);
+	if ((size_t)off + lpart > size)
+		lpart = (size_t)off < size ? size - (size_t)off : 0;
+
+	result = json_object_new_object();
+	json_object_object_add(result, "part", json_object_new_string_len(lpart ? DATA_STR(data) : "", (int)lpart));
+	json_object_object_add(result, "offset", json_object_new_int64(off));
+	json_object_object_add(result, "size", json_object_new_int64((int64_t)size));
+	afb_req_success(req, result, NULL);
+	xdb_release(&data);
+}
+
+/**
+ * The verb read when the value isn't cached, run by the read queue
+ */
+static void read_offloaded(struct afb_req req)
+{
+	DATA key;
+	int ret;
+
+	struct json_object* args;
+	struct json_object* offset;
+	struct json_object* length;
+	struct json_object* result;
+	struct json_object* value;
+	struct json_object* item;
 
 	if (get_key(req, &key))
 		return;
 
-	AFB_INFO("delete: key=%s", DATA_STR(key));
-	xdb_delete(req, &key);
-	free(DATA_PTR(key));
+	/* read of a part? */
+	args = afb_req_json(req);
+	if (!json_object_object_get_ex(args, "offset", &offset))
+		offset = NULL;
+	if (!json_object_object_get_ex(args, "length", &length))
+		length = NULL;
+	if (offset || length)
+	{
+		read_part(req, &key, offset, length);
+		return;
+	}
+
+	AFB_INFO("read: key=%s:%s", KEY_LOG(key));
+	ret = read_value(&key, &value, json_object_object_get_ex(args, "raw", &item) && json_object_get_boolean(item));
+	if (ret == 0)
+	{
+		result = json_object_new_object();
+		json_object_object_add(result, "value", value);
+		afb_req_success(req, result, NULL);
+	}
+	else
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
 }
 
+/**
+ * The verb read replies at once with a cached value, else it waits for
+ * the disk and is offloaded to the read queue
+ */
 static void verb_read(struct afb_req req)
 {
 	DATA key;
 
+	struct json_object* args;
+	struct json_object* item;
+	struct json_object* result;
+	struct json_object* value;
+
 	if (get_key(req, &key))
 		return;
 
-	AFB_INFO("read: key=%s", DATA_STR(key));
-	xdb_get(req, &key);
-	free(DATA_PTR(key));
+	args = afb_req_json(req);
+	value = json_object_object_get_ex(args, "offset", &item) || json_object_object_get_ex(args, "length", &item)
+		? NULL : cache_get(DATA_PTR(key), DATA_SZ(key), NULL);
+	if (!value)
+	{
+		offload(req, read_jobs, read_offloaded);
+		return;
+	}
+
+	AFB_INFO("read: key=%s:%s", KEY_LOG(key));
+	result = json_object_new_object();
+	json_object_object_add(result, "value", value);
+	afb_req_success(req, result, NULL);
 }
 
-// ----- Binding's configuration -----
+// ----- Expiry -----
+
 /*
-static const struct afb_auth ll_database_binding_auths[] = {
-};
-*/
+ * The keys that expire are in an index ordered by expiry time, built
+ * at start from the records. A thread removes the expired records by
+ * batches of EXPIRY_BATCH separated by pauses of EXPIRY_PAUSE_MS.
+ * Meanwhile the reads treat them as missing.
+ */
+static pthread_t expiry_thread;
+static unsigned long long expired_count;
 
-#define VERB(name_,auth_,info_,sess_) {\
-	.verb = #name_, \
-	.callback = verb_##name_, \
-	.auth = auth_, \
-	.info = info_, \
-	.session = sess_ }
+/**
+ * Removes the record of 'entry' if it still expires at the time of the
+ * entry: the entries of the records rewritten since are obsolete
+ * Returns 1 if removed or else 0
+ */
+static int expire(struct expiry_entry *entry)
+{
+	DATA key;
+	time_t expiry;
+	int removed, ret;
+
+	removed = 0;
+	DATA_SET(&key, entry->key, entry->size);
+	pthread_mutex_lock(&write_lock);
+	if (read_expiry(&key, &expiry) == 0 && expiry == entry->expiry)
+	{
+		ret = xdb_delete(&key);
+		cache_drop(DATA_PTR(key), DATA_SZ(key));
+		if (ret == 0)
+		{
+			bloom_remove_key();
+			watch_notify(DATA_PTR(key), DATA_SZ(key), key_skip(&key), "expire", NULL);
+			removed = 1;
+		}
+	}
+	pthread_mutex_unlock(&write_lock);
+	free(entry->key);
+	return removed;
+}
+
+static void *expiry_thread_main(void *arg)
+{
+	struct expiry_entry entries[EXPIRY_BATCH];
+	struct timespec ts;
+	size_t i, n;
+	unsigned removed;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = EXPIRY_PAUSE_MS * 1000000L;
+	for (;;)
+	{
+		expiry_wait();
+		n = expiry_take(time(NULL), entries, EXPIRY_BATCH);
+		for (removed = 0, i = 0 ; i < n ; i++)
+			removed += (unsigned)expire(&entries[i]);
+		if (removed)
+		{
+			AFB_INFO("expired %u record(s)", removed);
+			commit_writes(removed);
+			__atomic_add_fetch(&expired_count, removed, __ATOMIC_RELAXED);
+		}
+		nanosleep(&ts, NULL);
+	}
+	return NULL;
+}
+
+static int index_expiry(void *closure, DATA *key, DATA *data)
+{
+	time_t expiry;
+
+	expiry = record_expiry(data);
+	if (expiry && expiry_add(DATA_PTR(*key), DATA_SZ(*key), expiry) < 0)
+	{
+		*(int*)closure = -1;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Initialize the index of the keys that expire from the records
+ * and start the thread removing them.
+ */
+static int init_expiry()
+{
+	DATA all;
+	int ret, error;
+
+	error = 0;
+	DATA_SET(&all, "", 0);
+	ret = xdb_scan(&all, &all, 1, index_expiry, &error);
+	if (ret != 0 || error)
+	{
+		AFB_ERROR("Can't index the keys that expire");
+		return -1;
+	}
+	AFB_INFO("%zu key(s) expire", expiry_count());
+
+	if (pthread_create(&expiry_thread, NULL, expiry_thread_main, NULL))
+	{
+		AFB_ERROR("Can't start the expiry thread");
+		return -1;
+	}
+	return 0;
+}
+
+// ----- Atomic verbs -----
+
+/*
+ * A modifier computes in 'value' the new value from the 'current' one,
+ * NULL if the key doesn't exist, and the arguments of the request.
+ * It returns NULL on success or the error code.
+ */
+typedef const char *(*modifier)(struct json_object *current, struct json_object *args, struct json_object **value);
+
+/**
+ * Gets the current value of 'key' in 'current', unless NULL, and its
+ * expiry time in 'expiry', with the write lock held.
+ * Returns 0, XDB_NOTFOUND if the key is missing or expired or an error
+ */
+static int get_current(DATA *key, struct json_object **current, time_t *expiry)
+{
+	DATA data;
+	int ret;
+	unsigned long long start;
+
+	struct json_object* value;
+
+	*expiry = 0;
+	value = cache_get(DATA_PTR(*key), DATA_SZ(*key), expiry);
+	if (value)
+		ret = 0;
+	else if (!bloom_may_exist(key))
+		ret = XDB_NOTFOUND;
+	else
+	{
+		start = metrics_clock();
+		ret = xdb_get(key, &data);
+		metrics_backend(start, ret ? 0 : DATA_SZ(data), 0);
+		if (ret == XDB_NOTFOUND)
+			bloom_false_positive();
+		else if (ret == 0)
+		{
+			*expiry = record_expiry(&data);
+			if (is_expired(*expiry))
+			{
+				*expiry = 0;
+				ret = XDB_NOTFOUND;
+			}
+			else if (current)
+				value = get_value(&data);
+			xdb_release(&data);
+		}
+	}
+	if (current)
+		*current = value;
+	else
+		json_object_put(value);
+	return ret;
+}
+
+/**
+ * Replaces atomically the value of the key of 'req' by the value that
+ * 'modify' computes from the current one and replies the new value.
+ * The reason of a refusal of the modifier, as mismatch, is the status of
+ * the failure, the errors of the database fail with the status failed.
+ */
+static void modify_value(struct afb_req req, modifier modify)
+{
+	DATA key;
+	DATA data;
+	int ret;
+	time_t expiry;
+	unsigned long long start;
+
+	const char* error;
+	const char* reason;
+
+	struct json_object* current;
+	struct json_object* value;
+	struct json_object* result;
+
+	if (get_key(req, &key))
+		return;
+
+	AFB_INFO("modify: key=%s:%s", KEY_LOG(key));
+	error = reason = NULL;
+	pthread_mutex_lock(&write_lock);
+	ret = get_current(&key, &current, &expiry);
+	/* the new value keeps the expiry time of the current one */
+	value = NULL;
+	if (ret != 0 && ret != XDB_NOTFOUND)
+		error = xdb_strerror(ret);
+	else if ((reason = modify(current, afb_req_json(req), &value) ?: record_value(value, expiry, &data)))
+		error = reason;
+	else
+	{
+		start = metrics_clock();
+		ret = xdb_put(&key, &data, 1);
+		metrics_backend(start, 0, ret ? 0 : DATA_SZ(key) + DATA_SZ(data));
+		if (ret != 0)
+			error = xdb_strerror(ret);
+		else
+		{
+			bloom_add_key(&key);
+			if (DATA_SZ(data) <= CACHE_VALUE_MAX)
+				cache_set(DATA_PTR(key), DATA_SZ(key), value, expiry);
+			else
+				cache_drop(DATA_PTR(key), DATA_SZ(key));
+			watch_notify(DATA_PTR(key), DATA_SZ(key), key_skip(&key), current ? "update" : "insert", value);
+		}
+	}
+	pthread_mutex_unlock(&write_lock);
+	json_object_put(current);
+
+	if (!error && (ret = commit_writes(1)))
+		error = xdb_strerror(ret);
+	if (error)
+	{
+		json_object_put(value);
+		if (reason)
+			fail_f(req, reason, "key %s", &DATA_STR(key)[key_skip(&key)]);
+		else
+			fail_f(req, "failed", "%s", error);
+	}
+	else
+	{
+		result = json_object_new_object();
+		json_object_object_add(result, "value", value);
+		afb_req_success(req, result, NULL);
+	}
+}
+
+/* sets 'value' if the current value is 'expected', absent meaning no value */
+static const char *cas_modifier(struct json_object *current, struct json_object *args, struct json_object **value)
+{
+	struct json_object* expected;
+	struct json_object* item;
+
+	if (!json_object_object_get_ex(args, "value", &item))
+		return "no-value";
+	if (!json_object_object_get_ex(args, "expected", &expected))
+	{
+		if (current)
+			return "mismatch";
+	}
+	else if (!current || !json_object_equal(current, expected))
+		return "mismatch";
+	*value = json_object_get(item);
+	return NULL;
+}
+
+/* adds 'delta' (default 1) to the current number, absent meaning 0, the sum of integers must fit in 64 bits */
+static const char *incr_modifier(struct json_object *current, struct json_object *args, struct json_object **value)
+{
+	struct json_object* delta;
+	int64_t sum;
+
+	if (!json_object_object_get_ex(args, "delta", &delta))
+		delta = NULL;
+	else if (!json_object_is_type(delta, json_type_int) && !json_object_is_type(delta, json_type_double))
+		return "bad-delta";
+
+	if (current && !json_object_is_type(current, json_type_int) && !json_object_is_type(current, json_type_double))
+		return "not-a-number";
+
+	if ((current && json_object_is_type(current, json_type_double))
+	 || (delta && json_object_is_type(delta, json_type_double)))
+		*value = json_object_new_double((current ? json_object_get_double(current) : 0)
+					+ (delta ? json_object_get_double(delta) : 1));
+	else if (__builtin_add_overflow(current ? json_object_get_int64(current) : 0,
+					delta ? json_object_get_int64(delta) : 1, &sum))
+		return "overflow";
+	else
+		*value = json_object_new_int64(sum);
+	return NULL;
+}
+
+/* returns a new object of 'target' patched by 'patch' (RFC 7386), 'target' is left unchanged */
+static struct json_object *merge_patch(struct json_object *target, struct json_object *patch)
+{
+	struct json_object* result;
+	struct json_object* sub;
+
+	if (!json_object_is_type(patch, json_type_object))
+		return json_object_get(patch);
+
+	result = json_object_new_object();
+	if (json_object_is_type(target, json_type_object))
+	{
+		json_object_object_foreach(target, tkey, tval)
+			json_object_object_add(result, tkey, json_object_get(tval));
+	}
+	json_object_object_foreach(patch, pkey, pval)
+	{
+		if (!pval)
+			json_object_object_del(result, pkey);
+		else
+		{
+			if (!json_object_object_get_ex(result, pkey, &sub))
+				sub = NULL;
+			json_object_object_add(result, pkey, merge_patch(sub, pval));
+		}
+	}
+	return result;
+}
+
+/* merges the patch 'value' into the current value */
+static const char *merge_modifier(struct json_object *current, struct json_object *args, struct json_object **value)
+{
+	struct json_object* patch;
+
+	if (!json_object_object_get_ex(args, "value", &patch))
+		return "no-value";
+	*value = merge_patch(current, patch);
+	return NULL;
+}
+
+static void verb_cas(struct afb_req req)
+{
+	modify_value(req, cas_modifier);
+}
+
+static void verb_incr(struct afb_req req)
+{
+	modify_value(req, incr_modifier);
+}
+
+static void verb_merge(struct afb_req req)
+{
+	modify_value(req, merge_modifier);
+}
+
+// ----- Batch verbs -----
+
+/**
+ * Returns the array named 'name' of the arguments of 'req'
+ * or NULL after replying the failure
+ */
+static struct json_object *get_array(struct afb_req req, const char *name)
+{
+	struct json_object* args;
+	struct json_object* array;
+
+	args = afb_req_json(req);
+	if (!json_object_object_get_ex(args, name, &array))
+	{
+		fail_f(req, "no-items", "no %s", name);
+		return NULL;
+	}
+	if (!json_object_is_type(array, json_type_array))
+	{
+		fail_f(req, "bad-items", "%s isn't an array", name);
+		return NULL;
+	}
+	return array;
+}
+
+/**
+ * Adds to 'results' the status of the item of 'key', a failed item is
+ * counted as a failure of the verb
+ * Returns 1 if 'error' isn't NULL or zero otherwise
+ */
+static int add_status(struct json_object *results, struct json_object *key, struct json_object *value, const char *error)
+{
+	struct json_object* status;
+
+	status = json_object_new_object();
+	json_object_object_add(status, "key", json_object_get(key));
+	if (value)
+		json_object_object_add(status, "value", value);
+	if (error)
+	{
+		json_object_object_add(status, "error", json_object_new_string(error));
+		metrics_fail(error);
+	}
+	json_object_array_add(results, status);
+	return !!error;
+}
+
+/**
+ * Replies to 'req' the per item 'results' of a batch
+ */
+static void reply_batch(struct afb_req req, struct json_object *results, int nerrors)
+{
+	afb_req_success_f(req, results, "%d item(s), %d failure(s)", (int)json_object_array_length(results), nerrors);
+}
+
+static void verb_read_many(struct afb_req req)
+{
+	DATA key;
+	int ret, nerrors, raw;
+	size_t i, n;
+
+	const struct appid* app;
+	const char* error;
+
+	struct json_object* keys;
+	struct json_object* item;
+	struct json_object* value;
+	struct json_object* results;
+
+	keys = get_array(req, "keys");
+	if (!keys)
+		return;
+	raw = json_object_object_get_ex(afb_req_json(req), "raw", &item) && json_object_get_boolean(item);
+	app = get_app(req);
+	if (!app)
+		return;
+
+	nerrors = 0;
+	results = json_object_new_array();
+	n = json_object_array_length(keys);
+	for (i = 0 ; i < n ; i++)
+	{
+		item = json_object_array_get_idx(keys, i);
+		error = make_key(app, item, &key);
+		if (error)
+			nerrors += add_status(results, item, NULL, error);
+		else
+		{
+			AFB_INFO("read_many: key=%s:%s", KEY_LOG(key));
+			ret = read_value(&key, &value, raw);
+			if (ret != 0)
+				nerrors += add_status(results, item, NULL, xdb_strerror(ret));
+			else
+				add_status(results, item, value, NULL);
+		}
+	}
+	reply_batch(req, results, nerrors);
+}
+
+static void verb_put_many(struct afb_req req)
+{
+	DATA key;
+	DATA data;
+	time_t expiry;
+	int ret, nerrors, replace;
+	size_t i, n;
+
+	const struct appid* app;
+	const char* error;
+
+	struct json_object* args;
+	struct json_object* items;
+	struct json_object* item;
+	struct json_object* jkey;
+	struct json_object* value;
+	struct json_object* results;
+
+	items = get_array(req, "items");
+	if (!items)
+		return;
+	args = afb_req_json(req);
+	replace = !json_object_object_get_ex(args, "replace", &item) || json_object_get_boolean(item);
+	app = get_app(req);
+	if (!app)
+		return;
+
+	nerrors = 0;
+	results = json_object_new_array();
+	n = json_object_array_length(items);
+	for (i = 0 ; i < n ; i++)
+	{
+		item = json_object_array_get_idx(items, i);
+		if (!json_object_object_get_ex(item, "key", &jkey))
+			nerrors += add_status(results, NULL, NULL, "no-key");
+		else if (!json_object_object_get_ex(item, "value", &value))
+			nerrors += add_status(results, jkey, NULL, "no-value");
+		else if ((error = get_expiry(item, &expiry))
+		      || (error = record_value(value, expiry, &data)))
+			nerrors += add_status(results, jkey, NULL, error);
+		else if ((error = make_key(app, jkey, &key)))
+			nerrors += add_status(results, jkey, NULL, error);
+		else
+		{
+			AFB_INFO("put_many: key=%s:%s, value=%s", KEY_LOG(key), record_text(&data));
+			ret = write_value(&key, &data, value, replace);
+			nerrors += add_status(results, jkey, NULL, ret ? xdb_strerror(ret) : NULL);
+		}
+	}
+
+	ret = commit_writes((unsigned)(n - (size_t)nerrors));
+	if (ret != 0)
+	{
+		json_object_put(results);
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
+	}
+	else
+		reply_batch(req, results, nerrors);
+}
+
+static void verb_delete_many(struct afb_req req)
+{
+	DATA key;
+	int ret, nerrors;
+	size_t i, n;
+
+	const struct appid* app;
+	const char* error;
+
+	struct json_object* keys;
+	struct json_object* item;
+	struct json_object* results;
+
+	keys = get_array(req, "keys");
+	if (!keys)
+		return;
+	app = get_app(req);
+	if (!app)
+		return;
+
+	nerrors = 0;
+	results = json_object_new_array();
+	n = json_object_array_length(keys);
+	for (i = 0 ; i < n ; i++)
+	{
+		item = json_object_array_get_idx(keys, i);
+		error = make_key(app, item, &key);
+		if (error)
+			nerrors += add_status(results, item, NULL, error);
+		else
+		{
+			AFB_INFO("delete_many: key=%s:%s", KEY_LOG(key));
+			ret = remove_value(&key);
+			nerrors += add_status(results, item, NULL, ret ? xdb_strerror(ret) : NULL);
+		}
+	}
+
+	ret = commit_writes((unsigned)(n - (size_t)nerrors));
+	if (ret != 0)
+	{
+		json_object_put(results);
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
+	}
+	else
+		reply_batch(req, results, nerrors);
+}
+
+// ----- Transaction verb -----
+
+#define TRANSACTION_MAX 256
+
+/* an operation of a transaction */
+struct operation
+{
+	const char *op;			/* insert, update, delete or cas */
+	struct json_object *args;	/* the arguments of the operation */
+	DATA key;
+	DATA data;			/* the data written, its pointer is NULL for a removal */
+	struct json_object *value;	/* the value written */
+	time_t expiry;
+	const char *event;		/* the operation told to the watchers */
+};
+
+/**
+ * Reads in 'operation' the operation 'item' of a transaction of 'app'
+ * Returns NULL on success or the error code
+ */
+static const char *read_operation(const struct appid *app, struct json_object *item, struct operation *operation)
+{
+	const char* error;
+
+	struct json_object* op;
+	struct json_object* key;
+	struct json_object* value;
+
+	memset(operation, 0, sizeof *operation);
+	operation->args = item;
+	if (!json_object_object_get_ex(item, "op", &op))
+		return "no-op";
+	operation->op = json_object_get_string(op);
+	if (!operation->op
+	 || (strcmp(operation->op, "insert") && strcmp(operation->op, "update")
+	  && strcmp(operation->op, "delete") && strcmp(operation->op, "cas")))
+		return "bad-op";
+	if (!json_object_object_get_ex(item, "key", &key))
+		return "no-key";
+	error = make_key(app, key, &operation->key);
+	if (error)
+		return error;
+
+	/* the value of a cas is known when checked */
+	operation->event = operation->op;
+	if (!strcmp(operation->op, "delete") || !strcmp(operation->op, "cas"))
+		return NULL;
+	if (!json_object_object_get_ex(item, "value", &value))
+		return "no-value";
+	operation->value = json_object_get(value);
+	return get_expiry(item, &operation->expiry)
+		?: record_value(operation->value, operation->expiry, &operation->data);
+}
+
+/**
+ * Returns the last of the 'count' first 'operations' on 'key' or NULL
+ */
+static struct operation *find_operation(struct operation *operations, size_t count, DATA *key)
+{
+	while (count--)
+		if (DATA_SZ(operations[count].key) == DATA_SZ(*key)
+		 && !memcmp(DATA_PTR(operations[count].key), DATA_PTR(*key), DATA_SZ(*key)))
+			return &operations[count];
+	return NULL;
+}
+
+/**
+ * Checks the operation 'index' of 'operations' against the current value
+ * of its key, as left by the previous operations, and completes a cas.
+ * Called with the write lock held.
+ * Returns NULL on success or the error code, "failed" with the error of
+ * the backend in 'ret'
+ */
+static const char *check_operation(struct operation *operations, size_t index, int *ret)
+{
+	struct operation *operation = &operations[index];
+	struct operation *previous;
+	const char* error;
+	int exists, cas;
+	time_t expiry;
+
+	struct json_object* current;
+
+	cas = !strcmp(operation->op, "cas");
+	current = NULL;
+	previous = find_operation(operations, index, &operation->key);
+	if (previous)
+	{
+		exists = DATA_PTR(previous->data) != NULL;
+		current = json_object_get(previous->value);
+		expiry = previous->expiry;
+	}
+	else
+	{
+		*ret = get_current(&operation->key, cas ? &current : NULL, &expiry);
+		if (*ret != 0 && *ret != XDB_NOTFOUND)
+			return "failed";
+		exists = *ret == 0;
+		*ret = 0;
+	}
+
+	if (!strcmp(operation->op, "insert"))
+		error = exists ? "exists" : NULL;
+	else if (!cas)
+		error = exists ? NULL : "missing";
+	else
+	{
+		/* the new value keeps the expiry time of the current one */
+		operation->expiry = expiry;
+		operation->event = exists ? "update" : "insert";
+		error = cas_modifier(current, operation->args, &operation->value)
+			?: record_value(operation->value, expiry, &operation->data);
+	}
+	json_object_put(current);
+	return error;
+}
+
+/**
+ * Updates the filter, the expiry index and the cache and notifies the
+ * watchers of the written 'operation'. Called with the write lock held.
+ */
+static void publish_operation(struct operation *operation)
+{
+	DATA *key = &operation->key;
+
+	if (!DATA_PTR(operation->data))
+	{
+		bloom_remove_key();
+		cache_drop(DATA_PTR(*key), DATA_SZ(*key));
+		watch_notify(DATA_PTR(*key), DATA_SZ(*key), key_skip(key), "delete", NULL);
+		return;
+	}
+
+	bloom_add_key(key);
+	/* a cas keeps the expiry time already indexed */
+	if (operation->expiry && strcmp(operation->op, "cas")
+	 && expiry_add(DATA_PTR(*key), DATA_SZ(*key), operation->expiry) < 0)
+		AFB_ERROR("can't index the expiry of %s:%s", KEY_LOG(*key));
+	if (DATA_SZ(operation->data) <= CACHE_VALUE_MAX)
+		cache_set(DATA_PTR(*key), DATA_SZ(*key), operation->value, operation->expiry);
+	else
+		cache_drop(DATA_PTR(*key), DATA_SZ(*key));
+	watch_notify(DATA_PTR(*key), DATA_SZ(*key), key_skip(key), operation->event, operation->value);
+}
+
+static void verb_transaction(struct afb_req req)
+{
+	struct operation* operations;
+	struct xdb_write* writes;
+	size_t i, n, count, index, size;
+	int ret;
+	unsigned long long start;
+
+	const struct appid* app;
+	const char* error;
+
+	struct json_object* items;
+
+	items = get_array(req, "operations");
+	if (!items)
+		return;
+	n = json_object_array_length(items);
+	if (!n)
+	{
+		afb_req_success(req, NULL, NULL);
+		return;
+	}
+	if (n > TRANSACTION_MAX)
+	{
+		fail_f(req, "bad-items", "at most %d operations", TRANSACTION_MAX);
+		return;
+	}
+	app = get_app(req);
+	if (!app)
+		return;
+	operations = scratch_alloc(n * sizeof *operations);
+	writes = scratch_alloc(n * sizeof *writes);
+	if (!operations || !writes)
+	{
+		fail(req, "out-of-memory", NULL);
+		return;
+	}
+
+	/* read the operations */
+	ret = 0;
+	error = NULL;
+	for (count = 0 ; !error && count < n ; count++)
+		error = read_operation(app, json_object_array_get_idx(items, count), &operations[count]);
+	index = count - 1;
+
+	/* check them in order then write them at once */
+	if (!error)
+	{
+		AFB_INFO("transaction: %zu operation(s)", n);
+		pthread_mutex_lock(&write_lock);
+		for (index = 0 ; index < n && !(error = check_operation(operations, index, &ret)) ; index++);
+		if (!error)
+		{
+			size = 0;
+			for (i = 0 ; i < n ; i++)
+			{
+				writes[i].key = operations[i].key;
+				writes[i].data = operations[i].data;
+				size += DATA_SZ(operations[i].key) + DATA_SZ(operations[i].data);
+			}
+			start = metrics_clock();
+			ret = xdb_apply(writes, n);
+			metrics_backend(start, 0, ret ? 0 : size);
+			for (i = 0 ; i < n ; i++)
+			{
+				if (ret == 0)
+					publish_operation(&operations[i]);
+				else
+					cache_drop(DATA_PTR(operations[i].key), DATA_SZ(operations[i].key));
+			}
+		}
+		pthread_mutex_unlock(&write_lock);
+	}
+	for (i = 0 ; i < count ; i++)
+		json_object_put(operations[i].value);
+
+	/* the transaction is synced once */
+	if (!error && !ret)
+		ret = commit_writes((unsigned)n);
+	if (ret != 0)
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
+	else if (error)
+		fail_f(req, error, "operation %zu", index);
+	else
+		afb_req_success(req, NULL, NULL);
+}
+
+// ----- Listing verb -----
+
+#define LIST_LIMIT_DEFAULT 100
+#define LIST_LIMIT_MAX     1000
+
+struct list
+{
+	struct json_object *items;
+	struct json_object *next;
+	size_t skip;
+	size_t bytes;
+	int withvalues;
+	int remain;
+};
+
+static int list_cb(void *closure, DATA *key, DATA *data)
+{
+	struct list *list = closure;
+	struct json_object *item;
+
+	if (!list->remain)
+	{
+		/* a record remains: the listing continues after the last key */
+		item = json_object_array_get_idx(list->items, json_object_array_length(list->items) - 1);
+		json_object_object_get_ex(item, "key", &list->next);
+		return 1;
+	}
+
+	/* expired records not yet removed are skipped when seen */
+	if (list->withvalues && is_expired(record_expiry(data)))
+		return 0;
+
+	item = json_object_new_object();
+	json_object_object_add(item, "key", json_object_new_string(&DATA_STR(*key)[list->skip]));
+	list->bytes += DATA_SZ(*key);
+	if (list->withvalues)
+	{
+		json_object_object_add(item, "value", get_value(data));
+		list->bytes += DATA_SZ(*data);
+	}
+	json_object_array_add(list->items, item);
+	list->remain--;
+	return 0;
+}
+
+static void verb_list(struct afb_req req)
+{
+	DATA prefix;
+	DATA start;
+	struct list list;
+	int ret;
+	unsigned long long begin;
+
+	const struct appid* app;
+	const char* error;
+	const char* uprefix;
+	const char* after;
+
+	struct json_object* args;
+	struct json_object* item;
+	struct json_object* result;
+
+	/* get the arguments */
+	args = afb_req_json(req);
+	list.remain = LIST_LIMIT_DEFAULT;
+	if (json_object_object_get_ex(args, "limit", &item))
+	{
+		list.remain = json_object_get_int(item);
+		if (list.remain <= 0 || list.remain > LIST_LIMIT_MAX)
+		{
+			fail_f(req, "bad-limit", "limit must be in 1..%d", LIST_LIMIT_MAX);
+			return;
+		}
+	}
+	list.withvalues = json_object_object_get_ex(args, "values", &item) && json_object_get_boolean(item);
+	uprefix = json_object_object_get_ex(args, "prefix", &item) ? json_object_get_string(item) : NULL;
+	after = json_object_object_get_ex(args, "after", &item) ? json_object_get_string(item) : NULL;
+
+	app = get_app(req);
+	if (!app)
+		return;
+
+	/* the prefix "appid:uprefix" has no tailing null, the walk starts
+	 * either at the prefix or just after the key "appid:after" */
+	error = record_key(app, uprefix ?: "", 0, scratch_alloc, &prefix);
+	if (!error)
+	{
+		if (!after || !*after)
+			start = prefix;
+		else
+			error = record_key(app, after, 2, scratch_alloc, &start);
+	}
+	if (error)
+	{
+		fail(req, error, NULL);
+		return;
+	}
+
+	AFB_INFO("list: prefix=%s:%s", KEY_LOG(prefix));
+	list.skip = key_skip(&prefix);
+	list.items = json_object_new_array();
+	list.next = NULL;
+	list.bytes = 0;
+	begin = metrics_clock();
+	ret = xdb_scan(&prefix, &start, list.withvalues, list_cb, &list);
+	metrics_backend(begin, list.bytes, 0);
+	if (ret != 0)
+	{
+		json_object_put(list.items);
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
+	}
+	else
+	{
+		result = json_object_new_object();
+		json_object_object_add(result, "items", list.items);
+		if (list.next)
+			json_object_object_add(result, "next", json_object_get(list.next));
+		afb_req_success(req, result, NULL);
+	}
+}
+
+// ----- Watching verbs -----
+
+/**
+ * Gets the pattern of the 'key' or of the 'prefix' of keys of 'req'
+ * Returns 0 on success or -1 after replying the failure
+ */
+static int get_pattern(struct afb_req req, DATA *pattern, int *prefix)
+{
+	const struct appid* app;
+	const char* error;
+
+	struct json_object* args;
+	struct json_object* item;
+
+	args = afb_req_json(req);
+	*prefix = !json_object_object_get_ex(args, "key", &item);
+	if (*prefix && !json_object_object_get_ex(args, "prefix", &item))
+	{
+		fail(req, "no-key", "a key or a prefix is required");
+		return -1;
+	}
+
+	app = get_app(req);
+	if (!app)
+		return -1;
+
+	if (*prefix)
+		error = record_key(app, json_object_get_string(item) ?: "", 0, scratch_alloc, pattern);
+	else
+		error = make_key(app, item, pattern);
+	if (error)
+	{
+		fail(req, error, NULL);
+		return -1;
+	}
+	return 0;
+}
+
+static void verb_subscribe(struct afb_req req)
+{
+	DATA pattern;
+	int prefix, ret;
+
+	if (get_pattern(req, &pattern, &prefix))
+		return;
+
+	AFB_INFO("subscribe: %s=%s:%s", prefix ? "prefix" : "key", KEY_LOG(pattern));
+	ret = watch_subscribe(req, DATA_PTR(pattern), DATA_SZ(pattern), prefix);
+	if (ret < 0)
+		fail(req, "failed", "can't subscribe");
+	else
+		afb_req_success(req, NULL, NULL);
+}
+
+static void verb_unsubscribe(struct afb_req req)
+{
+	DATA pattern;
+	int prefix, ret;
+
+	if (get_pattern(req, &pattern, &prefix))
+		return;
+
+	AFB_INFO("unsubscribe: %s=%s:%s", prefix ? "prefix" : "key", KEY_LOG(pattern));
+	ret = watch_unsubscribe(req, DATA_PTR(pattern), DATA_SZ(pattern), prefix);
+	if (ret < 0)
+		fail(req, "failed", "not subscribed");
+	else
+		afb_req_success(req, NULL, NULL);
+}
+
+// ----- Backup verbs -----
+
+#define EXPORT_SIZE_DEFAULT 65536
+#define EXPORT_SIZE_MAX     (1024 * 1024)
+
+/*
+ * The verbs 'export' and 'import' transfer the records of all the
+ * applications, or of those whose "appid:key" begins with a prefix, in
+ * the dump format (see dump.h) encoded in base64. The keys are written
+ * "appid:key", the numbers of the applications being local to the
+ * database. The export is made by chunks in key order: the reply gives
+ * the token 'next' to pass in the request of the following chunk. The
+ * records are imported as they come, the key order of the export being
+ * the one that the btrees load best.
+ */
+struct export
+{
+	char *buffer;		/* the records */
+	size_t size;		/* size of the records */
+	size_t allocated;	/* allocated size of the buffer */
+	size_t max;		/* size of the chunk */
+	size_t count;		/* count of records */
+	const char *prefix;	/* prefix of the keys "appid:key" */
+	size_t lprefix;		/* length of the prefix */
+	char *key;		/* the key "appid:key" of the record */
+	size_t lkey;		/* allocated size of the key */
+	char *next;		/* key of the next chunk if any */
+	int error;		/* out of memory */
+};
+
+static int export_cb(void *closure, DATA *key, DATA *data)
+{
+	struct export *export = closure;
+	size_t size, lkey;
+	char *buffer;
+
+	if (is_expired(record_expiry(data)))
+		return 0;
+
+	/* the records of the dictionary aren't exported */
+	lkey = appids_text(DATA_PTR(*key), DATA_SZ(*key), export->key, export->lkey);
+	if (lkey > export->lkey)
+	{
+		buffer = realloc(export->key, lkey);
+		if (!buffer)
+		{
+			export->error = 1;
+			return 1;
+		}
+		export->key = buffer;
+		export->lkey = lkey;
+		appids_text(DATA_PTR(*key), DATA_SZ(*key), export->key, export->lkey);
+	}
+	if (!lkey || lkey <= export->lprefix || memcmp(export->key, export->prefix, export->lprefix))
+		return 0;
+
+	/* a chunk has at least one record */
+	size = dump_record_size(lkey, DATA_SZ(*data));
+	if (export->count && export->size + size > export->max)
+	{
+		export->next = strdup(export->key);
+		export->error = !export->next;
+		return 1;
+	}
+
+	if (export->size + size > export->allocated)
+	{
+		buffer = realloc(export->buffer, export->size + size);
+		if (!buffer)
+		{
+			export->error = 1;
+			return 1;
+		}
+		export->buffer = buffer;
+		export->allocated = export->size + size;
+	}
+	dump_record(&export->buffer[export->size], export->key, lkey, DATA_PTR(*data), DATA_SZ(*data));
+	export->size += size;
+	export->count++;
+	return 0;
+}
+
+static void verb_export(struct afb_req req)
+{
+	DATA prefix;
+	DATA start;
+	struct export export;
+	int ret;
+	unsigned long long begin;
+
+	size_t size;
+
+	const char* next;
+	const char* colon;
+	char* text;
+	char* rprefix;
+	char* rnext;
+
+	struct json_object* args;
+	struct json_object* item;
+	struct json_object* result;
+
+	/* get the arguments */
+	args = afb_req_json(req);
+	export.max = EXPORT_SIZE_DEFAULT;
+	if (json_object_object_get_ex(args, "size", &item))
+	{
+		export.max = (size_t)json_object_get_int64(item);
+		if (!export.max || export.max > EXPORT_SIZE_MAX)
+		{
+			fail_f(req, "bad-size", "size must be in 1..%d", EXPORT_SIZE_MAX);
+			return;
+		}
+	}
+	export.prefix = json_object_object_get_ex(args, "prefix", &item) ? json_object_get_string(item) ?: "" : "";
+	export.lprefix = strlen(export.prefix);
+	next = json_object_object_get_ex(args, "next", &item) ? json_object_get_string(item) : NULL;
+
+	/* a prefix with a colon is in the records of one application, else
+	 * all the records are walked. The export doesn't give numbers to the
+	 * applications: an unknown application has no records. */
+	DATA_SET(&prefix, "", 0);
+	rprefix = NULL;
+	colon = memchr(export.prefix, ':', export.lprefix);
+	if (colon)
+	{
+		rprefix = malloc(export.lprefix + APPIDS_NUMBER_MAX);
+		if (!rprefix)
+		{
+			fail(req, "out-of-memory", NULL);
+			return;
+		}
+		size = appids_key(export.prefix, export.lprefix, rprefix, 0);
+		if (!size)
+		{
+			free(rprefix);
+			result = json_object_new_object();
+			json_object_object_add(result, "data", json_object_new_string(""));
+			json_object_object_add(result, "count", json_object_new_int64(0));
+			afb_req_success(req, result, NULL);
+			return;
+		}
+		DATA_SET(&prefix, rprefix, size);
+	}
+
+	/* the token is the key "appid:key" of the next chunk */
+	start = prefix;
+	rnext = NULL;
+	if (next)
+	{
+		rnext = malloc(strlen(next) + 1 + APPIDS_NUMBER_MAX);
+		size = rnext ? appids_key(next, strlen(next) + 1, rnext, 0) : 0;
+		if (!size)
+		{
+			free(rnext);
+			free(rprefix);
+			fail(req, "bad-next", NULL);
+			return;
+		}
+		DATA_SET(&start, rnext, size);
+	}
+
+	AFB_INFO("export: prefix=%s", export.prefix);
+	export.buffer = NULL;
+	export.size = export.allocated = export.count = 0;
+	export.key = NULL;
+	export.lkey = 0;
+	export.next = NULL;
+	export.error = 0;
+	begin = metrics_clock();
+	ret = xdb_scan(&prefix, &start, 1, export_cb, &export);
+	metrics_backend(begin, export.size, 0);
+	if (ret == 0 && !export.error)
+	{
+		text = malloc(dump_base64_size(export.size) + 1);
+		if (!text)
+			export.error = 1;
+		else
+		{
+			dump_to_base64(text, export.buffer, export.size);
+			result = json_object_new_object();
+			json_object_object_add(result, "data", json_object_new_string(text));
+			json_object_object_add(result, "count", json_object_new_int64((int64_t)export.count));
+			if (export.next)
+				json_object_object_add(result, "next", json_object_new_string(export.next));
+			afb_req_success(req, result, NULL);
+			free(text);
+		}
+	}
+	if (ret != 0)
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
+	else if (export.error)
+		fail(req, "out-of-memory", NULL);
+	free(export.buffer);
+	free(export.key);
+	free(export.next);
+	free(rprefix);
+	free(rnext);
+}
+
+static void verb_import(struct afb_req req)
+{
+	DATA* keys;
+	DATA* values;
+	size_t i, n, size, ksize, vsize;
+	int ret, rc;
+	time_t expiry;
+	unsigned long long start;
+
+	const char* text;
+	const char* p;
+	const char* end;
+	const void* key;
+	const void* value;
+	char* buffer;
+	char* rkeys;
+	char* rkey;
+
+	struct json_object* args;
+	struct json_object* item;
+	struct json_object* result;
+
+	/* decode the records */
+	args = afb_req_json(req);
+	if (!json_object_object_get_ex(args, "data", &item)
+	 || !(text = json_object_get_string(item)))
+	{
+		fail(req, "no-data", NULL);
+		return;
+	}
+	buffer = dump_from_base64(text, strlen(text), &size);
+	if (!buffer)
+	{
+		fail(req, "bad-data", "invalid base64");
+		return;
+	}
+
+	/* count then check the records, the expired ones are dropped */
+	n = 0;
+	end = &buffer[size];
+	for (p = buffer ; (rc = dump_next(&p, end, &key, &ksize, &value, &vsize)) > 0 ; n++);
+	keys = rc < 0 ? NULL : malloc(n * sizeof *keys);
+	values = rc < 0 ? NULL : malloc(n * sizeof *values);
+	rkeys = rc < 0 ? NULL : malloc(size + n * APPIDS_NUMBER_MAX);
+	if (rc < 0 || !keys || !values || !rkeys)
+	{
+		free(keys);
+		free(values);
+		free(rkeys);
+		free(buffer);
+		if (rc < 0)
+			fail(req, "bad-data", "truncated record");
+		else
+			fail(req, "out-of-memory", NULL);
+		return;
+	}
+	/* the keys "appid:key" are translated in 'rkeys' */
+	n = 0;
+	rkey = rkeys;
+	for (p = buffer ; dump_next(&p, end, &key, &ksize, &value, &vsize) > 0 ;)
+	{
+		DATA_SET(&values[n], value, vsize);
+		if (!ksize || ((const char*)key)[ksize - 1]
+		 || !vsize || ((const char*)value)[vsize - 1]
+		 || !(ksize = appids_key(key, ksize, rkey, 1)))
+		{
+			fail_f(req, "bad-data", "invalid record %zu", n);
+			goto end;
+		}
+		if (!is_expired(record_expiry(&values[n])))
+		{
+			DATA_SET(&keys[n], rkey, ksize);
+			rkey += ksize;
+			n++;
+		}
+	}
+
+	AFB_INFO("import: %zu record(s)", n);
+	pthread_mutex_lock(&write_lock);
+	start = metrics_clock();
+	ret = xdb_load(keys, values, n);
+	metrics_backend(start, 0, ret ? 0 : size);
+	for (i = 0 ; ret == 0 && i < n ; i++)
+	{
+		bloom_add_key(&keys[i]);
+		cache_drop(DATA_PTR(keys[i]), DATA_SZ(keys[i]));
+		expiry = record_expiry(&values[i]);
+		if (expiry && expiry_add(DATA_PTR(keys[i]), DATA_SZ(keys[i]), expiry) < 0)
+			AFB_ERROR("can't index the expiry of %s:%s", KEY_LOG(keys[i]));
+		watch_notify(DATA_PTR(keys[i]), DATA_SZ(keys[i]), key_skip(&keys[i]), "import", NULL);
+	}
+	pthread_mutex_unlock(&write_lock);
+
+	if (ret == 0)
+		ret = commit_writes((unsigned)n);
+	if (ret != 0)
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
+	else
+	{
+		result = json_object_new_object();
+		json_object_object_add(result, "count", json_object_new_int64((int64_t)n));
+		afb_req_success(req, result, NULL);
+	}
+end:
+	free(keys);
+	free(values);
+	free(rkeys);
+	free(buffer);
+}
+
+// ----- Durability verb -----
+
+static void verb_flush(struct afb_req req)
+{
+	int ret;
+
+	ret = flush_writes();
+	if (ret == 0)
+		afb_req_success(req, NULL, NULL);
+	else
+		fail_f(req, "failed", "%s", xdb_strerror(ret));
+}
+
+// ----- Compaction verb -----
+
+static void verb_compact(struct afb_req req)
+{
+	if (!XDB_CAN_COMPACT)
+	{
+		fail(req, "not-supported", "the backend can't compact");
+		return;
+	}
+
+	pthread_mutex_lock(&compact_mutex);
+	compact_requested = 1;
+	pthread_cond_signal(&compact_cond);
+	pthread_mutex_unlock(&compact_mutex);
+	afb_req_success(req, NULL, "compaction requested");
+}
+
+// ----- Statistics verb -----
+
+static struct json_object *jobs_stats_json(struct jobs *jobs)
+{
+	struct jobs_stats jstats;
+	struct json_object* result;
+
+	jobs_get_stats(jobs, &jstats);
+	result = json_object_new_object();
+	json_object_object_add(result, "depth", json_object_new_int64((int64_t)jstats.depth));
+	json_object_object_add(result, "pending", json_object_new_int64((int64_t)jstats.pending));
+	json_object_object_add(result, "max-pending", json_object_new_int64((int64_t)jstats.max_pending));
+	json_object_object_add(result, "done", json_object_new_int64((int64_t)jstats.done));
+	json_object_object_add(result, "rejected", json_object_new_int64((int64_t)jstats.rejected));
+	json_object_object_add(result, "wait-avg-us", json_object_new_int64((int64_t)(jstats.done ? jstats.wait_us / jstats.done : 0)));
+	json_object_object_add(result, "wait-max-us", json_object_new_int64((int64_t)jstats.wait_max_us));
+	json_object_object_add(result, "run-avg-us", json_object_new_int64((int64_t)(jstats.done ? jstats.run_us / jstats.done : 0)));
+	json_object_object_add(result, "run-max-us", json_object_new_int64((int64_t)jstats.run_max_us));
+	return result;
+}
+
+/* returns the upper bound in microseconds of the 'percent' percentile of 'm' */
+static unsigned long long percentile(struct metrics_verb *m, unsigned percent)
+{
+	unsigned long long count, rank;
+	int i;
+
+	rank = (m->backend_calls * percent + 99) / 100;
+	count = 0;
+	for (i = 0 ; i < METRICS_BUCKETS - 1 ; i++)
+	{
+		count += m->histogram[i];
+		if (count >= rank)
+			break;
+	}
+	/* the last bucket is unbounded, its lower bound is given */
+	return metrics_bucket_max(i < METRICS_BUCKETS - 1 ? i : i - 1);
+}
+
+static struct json_object *metrics_stats_json(struct metrics_verb *m)
+{
+	struct json_object* result;
+	struct json_object* failures;
+	struct json_object* backend;
+	struct json_object* histogram;
+	const char* reason;
+	int i, n;
+
+	failures = json_object_new_object();
+	for (i = 0 ; i < METRICS_REASONS ; i++)
+		if (m->failures[i] && (reason = metrics_reason(i)))
+			json_object_object_add(failures, reason, json_object_new_int64((int64_t)m->failures[i]));
+
+	/* the histogram stops at its last non empty bucket */
+	for (n = METRICS_BUCKETS ; n && !m->histogram[n - 1] ; n--);
+	histogram = json_object_new_array();
+	for (i = 0 ; i < n ; i++)
+		json_object_array_add(histogram, json_object_new_int64((int64_t)m->histogram[i]));
+
+	backend = json_object_new_object();
+	json_object_object_add(backend, "calls", json_object_new_int64((int64_t)m->backend_calls));
+	json_object_object_add(backend, "avg-us", json_object_new_int64((int64_t)(m->backend_calls ? m->backend_us / m->backend_calls : 0)));
+	json_object_object_add(backend, "p50-us", json_object_new_int64((int64_t)percentile(m, 50)));
+	json_object_object_add(backend, "p99-us", json_object_new_int64((int64_t)percentile(m, 99)));
+	json_object_object_add(backend, "histogram", histogram);
+
+	result = json_object_new_object();
+	json_object_object_add(result, "calls", json_object_new_int64((int64_t)m->calls));
+	json_object_object_add(result, "failures", failures);
+	json_object_object_add(result, "bytes-read", json_object_new_int64((int64_t)m->bytes_read));
+	json_object_object_add(result, "bytes-written", json_object_new_int64((int64_t)m->bytes_written));
+	json_object_object_add(result, "backend", backend);
+	return result;
+}
+
+static void verb_stats(struct afb_req req)
+{
+	struct metrics_verb metrics;
+	const char* name;
+	int id;
+	struct cache_stats cstats;
+	struct json_object* result;
+	struct json_object* cache;
+	struct json_object* sync;
+	struct json_object* queues;
+	struct json_object* verbs;
+	struct json_object* storage;
+	struct json_object* expiry;
+	struct json_object* filter;
+	struct json_object* args;
+	struct json_object* item;
+
+	cache_get_stats(&cstats);
+	cache = json_object_new_object();
+	json_object_object_add(cache, "capacity", json_object_new_int64((int64_t)cstats.capacity));
+	json_object_object_add(cache, "entries", json_object_new_int64((int64_t)cstats.entries));
+	json_object_object_add(cache, "hits", json_object_new_int64((int64_t)cstats.hits));
+	json_object_object_add(cache, "misses", json_object_new_int64((int64_t)cstats.misses));
+	json_object_object_add(cache, "evictions", json_object_new_int64((int64_t)cstats.evictions));
+
+	pthread_mutex_lock(&sync_mutex);
+	sync = json_object_new_object();
+	json_object_object_add(sync, "mode", json_object_new_string(durability_names[durability]));
+	json_object_object_add(sync, "pending", json_object_new_int64((int64_t)pending_writes));
+	json_object_object_add(sync, "syncs", json_object_new_int64((int64_t)sync_count));
+	pthread_mutex_unlock(&sync_mutex);
+
+	pthread_mutex_lock(&compact_mutex);
+	storage = json_object_new_object();
+	json_object_object_add(storage, "file-size", json_object_new_int64((int64_t)usage.file_size));
+	json_object_object_add(storage, "free-size", json_object_new_int64((int64_t)usage.free_size));
+	json_object_object_add(storage, "fragmentation", json_object_new_int64((int64_t)(usage.file_size ? usage.free_size * 100 / usage.file_size : 0)));
+	json_object_object_add(storage, "compacting", json_object_new_boolean(compacting));
+	json_object_object_add(storage, "compactions", json_object_new_int64((int64_t)compact_count));
+	json_object_object_add(storage, "reclaimed", json_object_new_int64((int64_t)reclaimed));
+	json_object_object_add(storage, "applications", json_object_new_int64((int64_t)appids_count()));
+	pthread_mutex_unlock(&compact_mutex);
+
+	expiry = json_object_new_object();
+	json_object_object_add(expiry, "indexed", json_object_new_int64((int64_t)expiry_count()));
+	json_object_object_add(expiry, "expired", json_object_new_int64((int64_t)__atomic_load_n(&expired_count, __ATOMIC_RELAXED)));
+
+	filter = bloom_stats_json();
+
+	queues = json_object_new_object();
+	json_object_object_add(queues, jobs_name(read_jobs), jobs_stats_json(read_jobs));
+	json_object_object_add(queues, jobs_name(write_jobs), jobs_stats_json(write_jobs));
+
+	verbs = json_object_new_object();
+	for (id = 0 ; !metrics_get(id, &name, &metrics) ; id++)
+		json_object_object_add(verbs, name, metrics_stats_json(&metrics));
+
+	/* the counters of the verbs restart after this reply */
+	args = afb_req_json(req);
+	if (json_object_object_get_ex(args, "reset", &item) && json_object_get_boolean(item))
+		metrics_reset();
+
+	result = json_object_new_object();
+	json_object_object_add(result, "cache", cache);
+	json_object_object_add(result, "durability", sync);
+	json_object_object_add(result, "queues", queues);
+	json_object_object_add(result, "storage", storage);
+	json_object_object_add(result, "expiry", expiry);
+	json_object_object_add(result, "bloom", filter);
+	json_object_object_add(result, "watches", json_object_new_int64((int64_t)watch_count()));
+	json_object_object_add(result, "verbs", verbs);
+	afb_req_success(req, result, NULL);
+}
+
+// ----- Binding's initialization -----
+
+/**
+ * @brief Initialize the binding.
+ * @return Exit code, zero if success.
+ */
+static int ll_database_binding_init()
+{
+	char path[PATH_MAX];
+	int ret;
+
+	ret = get_database_path(path, sizeof path);
+	if (ret < 0 || (int)ret >=  (int)(sizeof path))
+	{
+		AFB_ERROR("Can't compute the database filename");
+		return -1;
+	}
+
+	AFB_INFO("opening database %s", path);
+	ret = xdb_open(path);
+	if (ret < 0)
+		return ret;
+
+	ret = appids_init();
+	if (ret < 0)
+		return ret;
+
+	ret = init_durability();
+	if (ret < 0)
+		return ret;
+
+	ret = init_expiry();
+	if (ret < 0)
+		return ret;
+
+	ret = init_bloom();
+	if (ret < 0)
+		return ret;
+
+	ret = init_jobs();
+	if (ret < 0)
+		return ret;
+
+	ret = init_compaction();
+	if (ret < 0)
+		return ret;
+
+	return init_cache();
+}
+
+// ----- Binding's configuration -----
+
+static const struct afb_auth ll_database_binding_auths[] = {
+	{ .type = afb_auth_Permission, .text = "urn:AGL:permission:ll-database:platform:backup" }
+};
+
+#define METERED(name_) \
+	static void metered_##name_(struct afb_req req) { static int id = -1; scratch_reset(); metrics_call(&id, #name_); verb_##name_(req); }
+
+#define VERB(name_,auth_,info_,sess_) {\
+	.verb = #name_, \
+	.callback = metered_##name_, \
+	.auth = auth_, \
+	.info = info_, \
+	.session = sess_ }
+
+#define OFFLOADED(name_,jobs_) \
+	static void offload_##name_(struct afb_req req) { static int id = -1; metrics_call(&id, #name_); offload(req, jobs_, verb_##name_); }
+
+#define VERB_OFFLOADED(name_,auth_,info_,sess_) {\
+	.verb = #name_, \
+	.callback = offload_##name_, \
+	.auth = auth_, \
+	.info = info_, \
+	.session = sess_ }
+
+OFFLOADED(insert, write_jobs)
+OFFLOADED(update, write_jobs)
+OFFLOADED(delete, write_jobs)
+OFFLOADED(put_many, write_jobs)
+OFFLOADED(delete_many, write_jobs)
+OFFLOADED(flush, write_jobs)
+OFFLOADED(cas, write_jobs)
+OFFLOADED(incr, write_jobs)
+OFFLOADED(merge, write_jobs)
+OFFLOADED(transaction, write_jobs)
+OFFLOADED(read_many, read_jobs)
+OFFLOADED(list, read_jobs)
+OFFLOADED(export, read_jobs)
+OFFLOADED(import, write_jobs)
+METERED(read)
+METERED(subscribe)
+METERED(unsubscribe)
+METERED(compact)
+METERED(stats)
 
 static const afb_verb_v2 ll_database_binding_verbs[]= {
-	VERB(insert,	NULL, NULL, AFB_SESSION_NONE_V2),
-	VERB(update,	NULL, NULL, AFB_SESSION_NONE_V2),
-	VERB(delete,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(insert,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(update,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(delete,	NULL, NULL, AFB_SESSION_NONE_V2),
 	VERB(read,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(cas,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(incr,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(merge,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(read_many,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(put_many,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(delete_many,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(transaction,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(list,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(export,	&ll_database_binding_auths[0], NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(import,	&ll_database_binding_auths[0], NULL, AFB_SESSION_NONE_V2),
+	VERB_OFFLOADED(flush,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB(subscribe,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB(unsubscribe,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB(compact,	NULL, NULL, AFB_SESSION_NONE_V2),
+	VERB(stats,	NULL, NULL, AFB_SESSION_NONE_V2),
         { .verb = NULL}
 };
 
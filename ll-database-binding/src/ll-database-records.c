@@ -0,0 +1,118 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Check of the stored form of the records, shared by the binding and
+ * the other checks: the keys made for an application and the values
+ * with and without the header of their expiry, read back as the binding
+ * reads them. It needs no database.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <json-c/json.h>
+
+#include "record.h"
+#include "scratch.h"
+
+#define EXIT_SUCCESS		0
+#define EXIT_CHECK			4
+
+/// @brief Count of the failed checks.
+static unsigned failures;
+
+/// @brief Report the failure of @c condition.
+#define CHECK(condition) \
+	do { if (!(condition)) { failures++; fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); } } while(0)
+
+/// @brief The keys: the number of the application, the key, the null bytes asked.
+static void check_keys()
+{
+	static const struct appid app = { "records-app", 2, { 0x81, 0x02 } };
+	DATA key;
+
+	scratch_reset();
+	CHECK(record_key(&app, "abc", 1, scratch_alloc, &key) == NULL);
+	CHECK(DATA_SZ(key) == 6 && !memcmp(DATA_PTR(key), "\x81\x02" "abc", 6));
+
+	/* the prefixes of the scans have no null but are terminated */
+	CHECK(record_key(&app, "ab", 0, scratch_alloc, &key) == NULL);
+	CHECK(DATA_SZ(key) == 4 && !memcmp(DATA_PTR(key), "\x81\x02" "ab", 5));
+
+	/* the key after a key of the scans */
+	CHECK(record_key(&app, "ab", 2, scratch_alloc, &key) == NULL);
+	CHECK(DATA_SZ(key) == 6 && !memcmp(DATA_PTR(key), "\x81\x02" "ab\0", 6));
+
+	CHECK(record_key(&app, "", 0, scratch_alloc, &key) == NULL);
+	CHECK(DATA_SZ(key) == 2 && !memcmp(DATA_PTR(key), "\x81\x02", 3));
+
+	/* the programs out of the binding allocate them */
+	CHECK(record_key(&app, "abc", 1, malloc, &key) == NULL);
+	CHECK(DATA_SZ(key) == 6 && !memcmp(DATA_PTR(key), "\x81\x02" "abc", 6));
+	free(DATA_PTR(key));
+}
+
+/// @brief The values: the json text and its null, after the header of the expiry if any.
+static void check_values()
+{
+	struct json_object* value;
+	const unsigned char* stored;
+	time_t expiry;
+	DATA data;
+
+	scratch_reset();
+	value = json_object_new_string("a/b");
+	CHECK(record_value(value, 0, &data) == NULL);
+	CHECK(DATA_SZ(data) == 6 && !strcmp(DATA_STR(data), "\"a/b\""));
+	CHECK(record_expiry(&data) == 0);
+	CHECK(!strcmp(record_text(&data), "\"a/b\""));
+
+	expiry = (time_t)0x0102030405;
+	CHECK(record_value(value, expiry, &data) == NULL);
+	stored = DATA_PTR(data);
+	CHECK(DATA_SZ(data) == RECORD_EXPIRY_HEADER + 6);
+	CHECK(stored[0] == RECORD_EXPIRY_MARK && !memcmp(&stored[1], "\0\0\0\x01\x02\x03\x04\x05", 8));
+	CHECK(record_expiry(&data) == expiry);
+	CHECK(!strcmp(record_text(&data), "\"a/b\""));
+	json_object_put(value);
+
+	expiry = time(NULL) + 3600;
+	value = json_object_new_int(12);
+	CHECK(record_value(value, expiry, &data) == NULL);
+	CHECK(record_expiry(&data) == expiry);
+	CHECK(!strcmp(record_text(&data), "12"));
+	json_object_put(value);
+
+	/* values too short for a header or without the mark don't expire */
+	DATA_SET(&data, "\0011", 3);
+	CHECK(record_expiry(&data) == 0);
+	DATA_SET(&data, "\"123456789\"", 12);
+	CHECK(record_expiry(&data) == 0);
+	CHECK(!strcmp(record_text(&data), "\"123456789\""));
+}
+
+int main(int argc, char** argv)
+{
+	check_keys();
+	check_values();
+	scratch_reset();
+	printf("records: %u failures\n", failures);
+	return failures ? EXIT_CHECK : EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stress test of the concurrent accesses to the storage layer.
+ *
+ * Several threads run a random mix of reads, writes, deletions,
+ * transactions and scans, with keys made by record_key as the
+ * binding does. Each thread is an application of its own and checks
+ * every result against its model of its keys. All the threads also
+ * read and write shared keys whose values tell the key they belong to,
+ * so that a value read for another key or torn is detected. At the end,
+ * the keys of all the threads are checked again from one thread.
+ * The database is made in a new temporary directory removed at exit.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <pthread.h>
+
+#include "xdb.h"
+#include "appids.h"
+#include "record.h"
+
+#define EXIT_SUCCESS		0
+#define EXIT_CMDLINE		1
+#define EXIT_DATABASE		2
+#define EXIT_ALLOC			3
+#define EXIT_CHECK			4
+
+#define SHARED_APPID		"stress-shared"
+#define SHARED_KEYS			64
+#define APPLY_WRITES		3
+#define VALUE_MAX			64
+#define REPORT_MAX			10
+
+/// @brief Parameters of the run.
+static const char* directory = "/tmp";
+static unsigned key_count = 256;
+static unsigned op_count = 20000;
+static unsigned thread_count = 8;
+
+/// @brief Count of the failures reported, to limit their printing.
+static unsigned reported;
+
+/// @brief Per thread state: the version of each key, 0 when missing.
+typedef struct worker_
+{
+	pthread_t tid;
+	unsigned index;
+	unsigned seed;
+	char appid[32];
+	unsigned* versions;
+	unsigned failures;
+} worker;
+
+/// @brief Record a failure of the worker @c w and print the first ones.
+static void failed(worker* w, const char* what, unsigned n, int ret)
+{
+	w->failures++;
+	if (__atomic_fetch_add(&reported, 1, __ATOMIC_RELAXED) < REPORT_MAX)
+		fprintf(stderr, "thread %u: %s of key %u failed: %s\n", w->index, what, n, ret ? xdb_strerror(ret) : "bad result");
+}
+
+/// @brief Make the database key of the key number @c n of @c appid.
+static int make_key(const char* appid, unsigned n, DATA* key)
+{
+	const struct appid* app;
+	char ukey[32];
+	snprintf(ukey, sizeof ukey, "key-%06u", n);
+	app = appids_get(appid);
+	return !app || record_key(app, ukey, 1, malloc, key) ? -1 : 0;
+}
+
+/// @brief Make in @c buffer the json string value "<n>:<tag>:<version>".
+static void make_value(char* buffer, unsigned n, unsigned tag, unsigned version, DATA* data)
+{
+	int len = snprintf(buffer, VALUE_MAX, "\"%u:%u:%u\"", n, tag, version);
+	DATA_SET(data, buffer, (size_t)len + 1);
+}
+
+/// @brief Check that the own key @c n of @c w has its expected value.
+static void check_own(worker* w, unsigned n, const char* what)
+{
+	DATA key, data;
+	char expected[VALUE_MAX];
+	int ret;
+
+	if (make_key(w->appid, n, &key)) { failed(w, "make", n, 0); return; }
+	ret = xdb_get(&key, &data);
+	if (!w->versions[n])
+	{
+		if (ret != XDB_NOTFOUND)
+			failed(w, what, n, ret);
+		if (ret == 0)
+			xdb_release(&data);
+	}
+	else if (ret != 0)
+		failed(w, what, n, ret);
+	else
+	{
+		snprintf(expected, sizeof expected, "\"%u:%u:%u\"", n, w->index, w->versions[n]);
+		if (DATA_SZ(data) != strlen(expected) + 1 || memcmp(DATA_PTR(data), expected, DATA_SZ(data)))
+			failed(w, what, n, 0);
+		xdb_release(&data);
+	}
+	free(DATA_PTR(key));
+}
+
+/// @brief Write or delete the own key @c n of @c w and update the model.
+static void write_own(worker* w, unsigned n, int delete)
+{
+	DATA key, data;
+	char buffer[VALUE_MAX];
+	int ret;
+
+	if (make_key(w->appid, n, &key)) { failed(w, "make", n, 0); return; }
+	if (delete)
+	{
+		ret = xdb_delete(&key);
+		if (ret != 0)
+			failed(w, "delete", n, ret);
+		else
+			w->versions[n] = 0;
+	}
+	else
+	{
+		make_value(buffer, n, w->index, w->versions[n] + 1, &data);
+		ret = xdb_put(&key, &data, 1);
+		if (ret != 0)
+			failed(w, "write", n, ret);
+		else
+			w->versions[n]++;
+	}
+	free(DATA_PTR(key));
+}
+
+/// @brief Write or delete atomically APPLY_WRITES own keys of @c w.
+static void apply_own(worker* w)
+{
+	struct xdb_write writes[APPLY_WRITES];
+	char buffers[APPLY_WRITES][VALUE_MAX];
+	unsigned keys[APPLY_WRITES], next[APPLY_WRITES];
+	unsigned i, j;
+	int ret;
+
+	for (i = 0; i < APPLY_WRITES; i++)
+	{
+		/* distinct keys: the same key twice would need the order of the writes */
+		do
+		{
+			keys[i] = (unsigned)rand_r(&w->seed) % key_count;
+			for (j = 0; j < i && keys[j] != keys[i]; j++);
+		}
+		while (j < i);
+		if (make_key(w->appid, keys[i], &writes[i].key)) { failed(w, "make", keys[i], 0); break; }
+		if (w->versions[keys[i]] && rand_r(&w->seed) % 3 == 0)
+		{
+			next[i] = 0;
+			DATA_SET(&writes[i].data, NULL, 0);
+		}
+		else
+		{
+			next[i] = w->versions[keys[i]] + 1;
+			make_value(buffers[i], keys[i], w->index, next[i], &writes[i].data);
+		}
+	}
+	if (i == APPLY_WRITES)
+	{
+		ret = xdb_apply(writes, APPLY_WRITES);
+		if (ret != 0)
+			failed(w, "transaction", keys[0], ret);
+		else
+			for (j = 0; j < APPLY_WRITES; j++)
+				w->versions[keys[j]] = next[j];
+	}
+	while (i)
+		free(DATA_PTR(writes[--i].key));
+}
+
+/// @brief Count the keys given to the scan.
+static int count_cb(void* closure, DATA* key, DATA* data)
+{
+	(*(unsigned*)closure)++;
+	return 0;
+}
+
+/// @brief Scan the keys of @c w and check their count.
+static void scan_own(worker* w)
+{
+	const struct appid* app;
+	DATA prefix;
+	unsigned n, expected, count;
+	int ret;
+
+	app = appids_get(w->appid);
+	if (!app) { failed(w, "number", 0, 0); return; }
+	for (expected = n = 0; n < key_count; n++)
+		expected += w->versions[n] != 0;
+	DATA_SET(&prefix, app->number, app->size);
+	count = 0;
+	ret = xdb_scan(&prefix, &prefix, 0, count_cb, &count);
+	if (ret != 0 || count != expected)
+		failed(w, "scan", expected, ret);
+}
+
+/// @brief Read or write a shared key, that all the threads write.
+static void shared(worker* w, int write)
+{
+	DATA key, data;
+	char buffer[VALUE_MAX];
+	unsigned n, found;
+	int ret;
+
+	n = (unsigned)rand_r(&w->seed) % SHARED_KEYS;
+	if (make_key(SHARED_APPID, n, &key)) { failed(w, "make", n, 0); return; }
+	if (write)
+	{
+		make_value(buffer, n, w->index, (unsigned)rand_r(&w->seed), &data);
+		ret = xdb_put(&key, &data, 1);
+		if (ret != 0)
+			failed(w, "shared write", n, ret);
+	}
+	else
+	{
+		ret = xdb_get(&key, &data);
+		if (ret == 0)
+		{
+			/* the value must be a whole value of this key */
+			if (DATA_SZ(data) < 2 || DATA_STR(data)[DATA_SZ(data) - 1]
+			 || sscanf(DATA_STR(data), "\"%u:", &found) != 1 || found != n)
+				failed(w, "shared read", n, 0);
+			xdb_release(&data);
+		}
+		else if (ret != XDB_NOTFOUND)
+			failed(w, "shared read", n, ret);
+	}
+	free(DATA_PTR(key));
+}
+
+/// @brief Run the mix of one thread.
+static void* run(void* arg)
+{
+	worker* w = arg;
+	unsigned i, n, r;
+
+	for (i = 0; i < op_count; i++)
+	{
+		n = (unsigned)rand_r(&w->seed) % key_count;
+		r = (unsigned)rand_r(&w->seed) % 100;
+		if (r < 35)
+			check_own(w, n, "read");
+		else if (r < 55)
+			write_own(w, n, 0);
+		else if (r < 65)
+			write_own(w, n, w->versions[n] != 0);
+		else if (r < 80)
+			shared(w, 0);
+		else if (r < 88)
+			shared(w, 1);
+		else if (r < 94)
+			apply_own(w);
+		else
+			scan_own(w);
+	}
+	return NULL;
+}
+
+/// @brief Remove a file of the temporary directory.
+static int remove_cb(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+	return remove(path);
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d DIR     directory of the temporary directory (default /tmp)\n"
+		"  -k COUNT   count of keys of each thread (default 256)\n"
+		"  -n COUNT   count of operations of each thread (default 20000)\n"
+		"  -t COUNT   count of threads (default 8)\n",
+		name);
+}
+
+int main(int argc, char** argv)
+{
+	int opt, ret;
+	unsigned i, n, failures;
+	char temp[4096], path[4200];
+	worker* workers;
+
+	while ((opt = getopt(argc, argv, "d:k:n:t:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd': directory = optarg; break;
+			case 'k': key_count = (unsigned)atoi(optarg); break;
+			case 'n': op_count = (unsigned)atoi(optarg); break;
+			case 't': thread_count = (unsigned)atoi(optarg); break;
+			default: usage(argv[0]); return EXIT_CMDLINE;
+		}
+	}
+	if (!key_count || !thread_count)
+	{
+		usage(argv[0]);
+		return EXIT_CMDLINE;
+	}
+
+	snprintf(temp, sizeof temp, "%s/stress-XXXXXX", directory);
+	if (!mkdtemp(temp)) { perror(temp); return EXIT_DATABASE; }
+	snprintf(path, sizeof path, "%s/%s", temp, DBFILE);
+	if (xdb_open(path) || appids_init())
+	{
+		nftw(temp, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+		return EXIT_DATABASE;
+	}
+
+	workers = calloc(thread_count, sizeof *workers);
+	if (!workers) return EXIT_ALLOC;
+	for (i = 0; i < thread_count; i++)
+	{
+		workers[i].index = i;
+		workers[i].seed = i + 1;
+		snprintf(workers[i].appid, sizeof workers[i].appid, "stress-%u", i);
+		workers[i].versions = calloc(key_count, sizeof *workers[i].versions);
+		if (!workers[i].versions) return EXIT_ALLOC;
+	}
+	for (i = 0; i < thread_count; i++)
+		if (pthread_create(&workers[i].tid, NULL, run, &workers[i])) return EXIT_ALLOC;
+	for (i = 0; i < thread_count; i++)
+		pthread_join(workers[i].tid, NULL);
+
+	/* the final state of all the keys, after a sync */
+	ret = xdb_sync();
+	failures = ret != 0;
+	for (i = 0; i < thread_count; i++)
+	{
+		for (n = 0; n < key_count; n++)
+			check_own(&workers[i], n, "final read");
+		scan_own(&workers[i]);
+		failures += workers[i].failures;
+		free(workers[i].versions);
+	}
+	free(workers);
+
+	printf("%u threads, %u operations each: %u failures\n", thread_count, op_count, failures);
+	nftw(temp, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+	return failures ? EXIT_CHECK : EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Offline backup and restore of the database of the binding.
+ *
+ * It exports the records, all or those whose key "appid:key" begins
+ * with a prefix, into a dump file (see dump.h) and imports such a file,
+ * by batches of records given in key order to xdb_load.
+ * It must not run while the binding has the database open.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xdb.h"
+#include "appids.h"
+#include "dump.h"
+
+#define EXIT_SUCCESS		0
+#define EXIT_CMDLINE		1
+#define EXIT_DATABASE		2
+#define EXIT_ALLOC			3
+#define EXIT_FILE			4
+
+#define LOAD_BATCH			4096
+
+/// @brief State of an export.
+typedef struct exporter_
+{
+	FILE* file;
+	const char* prefix;
+	size_t lprefix;
+	char* key;
+	size_t lkey;
+	char* buffer;
+	size_t size;
+	unsigned long count;
+	int error;
+} exporter;
+
+/// @brief Write the record of @c key and @c data in the dump file.
+static int export_record(void* closure, DATA* key, DATA* data)
+{
+	exporter* e = closure;
+	size_t lkey = appids_text(DATA_PTR(*key), DATA_SZ(*key), e->key, e->lkey);
+	size_t size;
+	char* buffer;
+
+	if (lkey > e->lkey)
+	{
+		buffer = realloc(e->key, lkey);
+		if (!buffer) { e->error = EXIT_ALLOC; return 1; }
+		e->key = buffer;
+		e->lkey = lkey;
+		appids_text(DATA_PTR(*key), DATA_SZ(*key), e->key, e->lkey);
+	}
+	if (!lkey || lkey <= e->lprefix || memcmp(e->key, e->prefix, e->lprefix)) return 0;
+
+	size = dump_record_size(lkey, DATA_SZ(*data));
+	if (size > e->size)
+	{
+		buffer = realloc(e->buffer, size);
+		if (!buffer) { e->error = EXIT_ALLOC; return 1; }
+		e->buffer = buffer;
+		e->size = size;
+	}
+	dump_record(e->buffer, e->key, lkey, DATA_PTR(*data), DATA_SZ(*data));
+	if (fwrite(e->buffer, size, 1, e->file) != 1) { e->error = EXIT_FILE; return 1; }
+	e->count++;
+	return 0;
+}
+
+/// @brief Export the records whose key "appid:key" begins with @c prefix into the file @c filename.
+static int export_file(const char* filename, const char* prefix)
+{
+	exporter e = { NULL, prefix, strlen(prefix), NULL, 0, NULL, 0, 0, EXIT_SUCCESS };
+	DATA all;
+
+	e.file = fopen(filename, "wb");
+	if (!e.file) { perror(filename); return EXIT_FILE; }
+	if (fwrite(DUMP_MAGIC, DUMP_MAGIC_SIZE, 1, e.file) != 1) e.error = EXIT_FILE;
+
+	DATA_SET(&all, "", 0);
+	if (!e.error && xdb_scan(&all, &all, 1, export_record, &e) && !e.error) e.error = EXIT_DATABASE;
+	if (fclose(e.file) && !e.error) e.error = EXIT_FILE;
+	free(e.key);
+	free(e.buffer);
+
+	if (e.error == EXIT_FILE) perror(filename);
+	else if (!e.error) fprintf(stderr, "%lu record(s) exported\n", e.count);
+	return e.error;
+}
+
+/// @brief Import the records of the file @c filename.
+static int import_file(const char* filename)
+{
+	int fd, r = EXIT_SUCCESS;
+	struct stat st;
+	const char *map, *p, *q, *end;
+	const void *key, *value;
+	size_t ksize, vsize, n, size;
+	unsigned long count = 0;
+	char *rkeys = NULL, *rkey;
+	DATA* keys = malloc(LOAD_BATCH * sizeof *keys);
+	DATA* values = malloc(LOAD_BATCH * sizeof *values);
+
+	if (!keys || !values) return EXIT_ALLOC;
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) { perror(filename); return EXIT_FILE; }
+	map = st.st_size ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (map == MAP_FAILED || (size_t)st.st_size < DUMP_MAGIC_SIZE || memcmp(map, DUMP_MAGIC, DUMP_MAGIC_SIZE))
+	{
+		fprintf(stderr, "%s: not a dump file\n", filename);
+		return EXIT_FILE;
+	}
+	madvise((void*)map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	p = map + DUMP_MAGIC_SIZE;
+	end = map + st.st_size;
+	do
+	{
+		/* sizes the keys of the batch then translates the keys "appid:key" in rkeys */
+		for (q = p, size = 0, n = 0; n < LOAD_BATCH && dump_next(&q, end, &key, &ksize, &value, &vsize) > 0; n++)
+			size += ksize + APPIDS_NUMBER_MAX;
+		free(rkeys);
+		rkeys = rkey = malloc(size + 1);
+		if (!rkeys) { r = EXIT_ALLOC; break; }
+		for (n = 0; n < LOAD_BATCH && (r = dump_next(&p, end, &key, &ksize, &value, &vsize)) > 0; n++)
+		{
+			if (!ksize || ((const char*)key)[ksize - 1] || !(ksize = appids_key(key, ksize, rkey, 1)))
+			{
+				fprintf(stderr, "%s: invalid key of record %lu\n", filename, count + n);
+				r = EXIT_FILE;
+				break;
+			}
+			DATA_SET(&keys[n], rkey, ksize);
+			DATA_SET(&values[n], value, vsize);
+			rkey += ksize;
+		}
+		if (r == EXIT_FILE) break;
+		if (r < 0) { fprintf(stderr, "%s: truncated record\n", filename); r = EXIT_FILE; break; }
+		if (n && xdb_load(keys, values, n)) { r = EXIT_DATABASE; break; }
+		count += n;
+	}
+	while (r > 0);
+	if (r == 0 && xdb_sync()) r = EXIT_DATABASE;
+
+	munmap((void*)map, (size_t)st.st_size);
+	free(rkeys);
+	free(keys);
+	free(values);
+	if (!r) fprintf(stderr, "%lu record(s) imported\n", count);
+	return r;
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [-p PREFIX] export DATABASE FILE\n"
+		"       %s import DATABASE FILE\n"
+		"  -p PREFIX  only export the applications whose id begins with PREFIX\n",
+		name, name);
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+	const char* prefix = "";
+
+	while ((opt = getopt(argc, argv, "p:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'p': prefix = optarg; break;
+			default: usage(argv[0]); return EXIT_CMDLINE;
+		}
+	}
+	if (argc - optind != 3 || (strcmp(argv[optind], "export") && strcmp(argv[optind], "import")))
+	{
+		usage(argv[0]);
+		return EXIT_CMDLINE;
+	}
+
+	if (xdb_open(argv[optind + 1]) || appids_init()) return EXIT_DATABASE;
+	return strcmp(argv[optind], "export")
+		? import_file(argv[optind + 2])
+		: export_file(argv[optind + 2], prefix);
+}
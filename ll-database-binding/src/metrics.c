@@ -0,0 +1,291 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "metrics.h"
+
+/*
+ * Counters of the verbs. Each thread counts in its own slot, without
+ * lock nor atomic read-modify-write, and the readers sum the slots.
+ * The slot of an exiting thread is kept, with its counts, and reused by
+ * the next new thread. A reset doesn't touch the slots: it records the
+ * current sums as the baseline subtracted from the next readings.
+ */
+struct slot
+{
+	struct slot *next;
+	int owned;
+	struct metrics_verb verbs[METRICS_VERBS];
+};
+
+/* only the owner thread writes, the readers may load at any time */
+#define ADD(counter,value)  __atomic_store_n(&(counter), (counter) + (value), __ATOMIC_RELAXED)
+#define LOAD(counter)       __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static struct slot *slots;
+static struct metrics_verb baseline[METRICS_VERBS];
+
+/* the verbs and the reasons are only appended, their count is published last */
+static const char *verbs[METRICS_VERBS];
+static int nverbs;
+static const char *reasons[METRICS_REASONS];
+static int nreasons;
+
+static __thread struct slot *mine;
+static __thread int current = -1;
+
+static void release(void *arg)
+{
+	struct slot *slot = arg;
+
+	pthread_mutex_lock(&mutex);
+	slot->owned = 0;
+	pthread_mutex_unlock(&mutex);
+}
+
+static void make_key()
+{
+	pthread_key_create(&key, release);
+}
+
+/* returns the slot of the calling thread or NULL if out of memory */
+static struct slot *get_slot()
+{
+	struct slot *slot;
+
+	if (mine)
+		return mine;
+
+	pthread_once(&once, make_key);
+	pthread_mutex_lock(&mutex);
+	for (slot = slots ; slot && slot->owned ; slot = slot->next);
+	if (!slot)
+	{
+		slot = calloc(1, sizeof *slot);
+		if (slot)
+		{
+			slot->next = slots;
+			slots = slot;
+		}
+	}
+	if (slot)
+		slot->owned = 1;
+	pthread_mutex_unlock(&mutex);
+
+	if (slot)
+		pthread_setspecific(key, slot);
+	return mine = slot;
+}
+
+/* returns the index of 'name' in 'names', adding it if needed, or -1 when full */
+static int intern(const char **names, int *count, int max, const char *name)
+{
+	int i, n;
+	char *copy;
+
+	n = __atomic_load_n(count, __ATOMIC_ACQUIRE);
+	for (i = 0 ; i < n ; i++)
+		if (names[i] == name || !strcmp(names[i], name))
+			return i;
+
+	pthread_mutex_lock(&mutex);
+	n = *count;
+	for (; i < n && strcmp(names[i], name) ; i++);
+	if (i == n)
+	{
+		copy = i < max ? strdup(name) : NULL;
+		if (copy)
+		{
+			names[i] = copy;
+			__atomic_store_n(count, i + 1, __ATOMIC_RELEASE);
+		}
+		else
+			i = -1;
+	}
+	pthread_mutex_unlock(&mutex);
+	return i;
+}
+
+/**
+ * Counts a call of the 'verb' by the calling thread, that becomes its
+ * current verb. 'id' caches the identifier of the verb, it is initially -1.
+ */
+void metrics_call(int *id, const char *verb)
+{
+	struct slot *slot;
+	int i;
+
+	i = __atomic_load_n(id, __ATOMIC_RELAXED);
+	if (i < 0)
+	{
+		i = intern(verbs, &nverbs, METRICS_VERBS, verb);
+		__atomic_store_n(id, i, __ATOMIC_RELAXED);
+	}
+	current = i;
+	slot = get_slot();
+	if (slot && i >= 0)
+		ADD(slot->verbs[i].calls, 1);
+}
+
+/**
+ * Returns the current verb of the calling thread, to be given to
+ * 'metrics_enter' by the thread that will continue its processing
+ */
+int metrics_current()
+{
+	return current;
+}
+
+/**
+ * Sets the current verb of the calling thread without counting a call
+ */
+void metrics_enter(int id)
+{
+	current = id;
+}
+
+/**
+ * Counts a failure of the current verb for 'reason'
+ */
+void metrics_fail(const char *reason)
+{
+	struct slot *slot;
+	int i;
+
+	slot = get_slot();
+	if (!slot || current < 0)
+		return;
+
+	i = intern(reasons, &nreasons, METRICS_REASONS - 1, reason);
+	ADD(slot->verbs[current].failures[i < 0 ? METRICS_REASONS - 1 : i], 1);
+}
+
+/**
+ * Returns the current time in microseconds
+ */
+unsigned long long metrics_clock()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + (unsigned long long)ts.tv_nsec / 1000;
+}
+
+/**
+ * Counts for the current verb a call to the backend started at 'start'
+ * (given by 'metrics_clock') that read and wrote the given bytes
+ */
+void metrics_backend(unsigned long long start, size_t read, size_t written)
+{
+	struct slot *slot;
+	struct metrics_verb *m;
+	unsigned long long us;
+	int b;
+
+	slot = get_slot();
+	if (!slot || current < 0)
+		return;
+
+	us = metrics_clock() - start;
+	b = us <= 1 ? 0 : 64 - __builtin_clzll(us - 1);
+	m = &slot->verbs[current];
+	ADD(m->backend_calls, 1);
+	ADD(m->backend_us, us);
+	ADD(m->histogram[b < METRICS_BUCKETS ? b : METRICS_BUCKETS - 1], 1);
+	ADD(m->bytes_read, read);
+	ADD(m->bytes_written, written);
+}
+
+/* adds (sign 1) or subtracts (sign -1) the counters of 'from' to 'to' */
+static void sum(struct metrics_verb *to, struct metrics_verb *from, int sign)
+{
+	unsigned long long *t = (unsigned long long*)to;
+	unsigned long long *f = (unsigned long long*)from;
+	size_t i;
+
+	for (i = 0 ; i < sizeof *to / sizeof *t ; i++)
+		t[i] += sign > 0 ? LOAD(f[i]) : -f[i];
+}
+
+/* sums in 'metrics' the counters of the slots for the verb 'id' */
+static void sum_slots(int id, struct metrics_verb *metrics)
+{
+	struct slot *slot;
+
+	memset(metrics, 0, sizeof *metrics);
+	for (slot = slots ; slot ; slot = slot->next)
+		sum(metrics, &slot->verbs[id], 1);
+}
+
+/**
+ * Gets in 'verb' and 'metrics' the name and the counters since the last
+ * reset of the verb 'id'. Returns 0 or -1 if there is no such verb.
+ */
+int metrics_get(int id, const char **verb, struct metrics_verb *metrics)
+{
+	if (id < 0 || id >= __atomic_load_n(&nverbs, __ATOMIC_ACQUIRE))
+		return -1;
+
+	*verb = verbs[id];
+	pthread_mutex_lock(&mutex);
+	sum_slots(id, metrics);
+	sum(metrics, &baseline[id], -1);
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+/**
+ * Returns the failure reason of 'index' or NULL if there is no such reason
+ */
+const char *metrics_reason(int index)
+{
+	if (index == METRICS_REASONS - 1)
+		return "other";
+	if (index < 0 || index >= __atomic_load_n(&nreasons, __ATOMIC_ACQUIRE))
+		return NULL;
+	return reasons[index];
+}
+
+/**
+ * Returns the highest latency in microseconds counted in the bucket 'index'
+ */
+unsigned long long metrics_bucket_max(int index)
+{
+	return index < METRICS_BUCKETS - 1 ? 1ULL << index : ULLONG_MAX;
+}
+
+/**
+ * Restarts all the counters from zero
+ */
+void metrics_reset()
+{
+	int id, n;
+
+	n = __atomic_load_n(&nverbs, __ATOMIC_ACQUIRE);
+	pthread_mutex_lock(&mutex);
+	for (id = 0 ; id < n ; id++)
+		sum_slots(id, &baseline[id]);
+	pthread_mutex_unlock(&mutex);
+}
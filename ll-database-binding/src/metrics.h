@@ -0,0 +1,45 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#define METRICS_VERBS		32	/* maximum count of verbs */
+#define METRICS_REASONS		16	/* maximum count of failure reasons, the last is "other" */
+#define METRICS_BUCKETS		24	/* latency buckets: [0,1] ]1,2] ]2,4] ... ]2^22,+inf[ microseconds */
+
+struct metrics_verb
+{
+	unsigned long long calls;			/* count of calls */
+	unsigned long long failures[METRICS_REASONS];	/* count of failures by reason */
+	unsigned long long bytes_read;			/* bytes read from the backend */
+	unsigned long long bytes_written;		/* bytes written to the backend */
+	unsigned long long backend_calls;		/* count of calls to the backend */
+	unsigned long long backend_us;			/* total time in the backend in microseconds */
+	unsigned long long histogram[METRICS_BUCKETS];	/* times in the backend by bucket */
+};
+
+extern void metrics_call(int *id, const char *verb);
+extern int metrics_current();
+extern void metrics_enter(int id);
+extern void metrics_fail(const char *reason);
+extern unsigned long long metrics_clock();
+extern void metrics_backend(unsigned long long start, size_t read, size_t written);
+extern int metrics_get(int id, const char **verb, struct metrics_verb *metrics);
+extern const char *metrics_reason(int index);
+extern unsigned long long metrics_bucket_max(int index);
+extern void metrics_reset();
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <json-c/json.h>
+
+#include "record.h"
+#include "scratch.h"
+
+/*
+ * The stored form of the records of the binding, shared with the
+ * programs that check it. A key is the number of its application
+ * followed by the key given by the application. A value is its json
+ * text, with its tailing null, after the header of its expiry if any.
+ * The binding makes both in the scratch memory of the calling thread.
+ */
+
+#if !defined(TO_STRING_FLAGS)
+# if !defined(JSON_C_TO_STRING_NOSLASHESCAPE)
+#  define JSON_C_TO_STRING_NOSLASHESCAPE (1<<4)
+# endif
+# define TO_STRING_FLAGS (JSON_C_TO_STRING_PLAIN | JSON_C_TO_STRING_NOSLASHESCAPE)
+#endif
+
+/**
+ * Makes in 'key', in memory given by 'alloc' (scratch_alloc, malloc...),
+ * the database key of 'ukey' for the application 'app' followed by
+ * 'nnul' null bytes
+ * Returns NULL on success or the error code
+ */
+const char *record_key(const struct appid *app, const char *ukey, size_t nnul, void *(*alloc)(size_t), DATA *key)
+{
+	size_t lukey, size;
+	char *data;
+
+	lukey = strlen(ukey);
+	size = app->size + lukey + nnul;
+	data = alloc(size + !nnul);
+	if (!data)
+		return "out-of-memory";
+	memcpy(data, app->number, app->size);
+	memcpy(&data[app->size], ukey, lukey);
+	memset(&data[app->size + lukey], 0, nnul + !nnul);
+
+	DATA_SET(key, data, size);
+	return NULL;
+}
+
+/**
+ * Makes in 'data' the stored form of the json 'value' that expires at
+ * 'expiry' or never if zero. It is valid while 'value' is unchanged, the
+ * header being in the scratch memory.
+ * Returns NULL on success or the error code
+ */
+const char *record_value(struct json_object *value, time_t expiry, DATA *data)
+{
+	const char* string;
+	char* buffer;
+	size_t length;
+	uint64_t t;
+	int i;
+
+	string = json_object_to_json_string_ext(value, TO_STRING_FLAGS);
+	if (!string)
+		return "out-of-memory";
+
+	length = strlen(string) + 1; /* includes the tailing null */
+	if (!expiry)
+	{
+		DATA_SET(data, string, length);
+		return NULL;
+	}
+
+	buffer = scratch_alloc(RECORD_EXPIRY_HEADER + length);
+	if (!buffer)
+		return "out-of-memory";
+	buffer[0] = RECORD_EXPIRY_MARK;
+	for (t = (uint64_t)expiry, i = RECORD_EXPIRY_HEADER - 1 ; i > 0 ; i--, t >>= 8)
+		buffer[i] = (char)(t & 255);
+	memcpy(&buffer[RECORD_EXPIRY_HEADER], string, length);
+	DATA_SET(data, buffer, RECORD_EXPIRY_HEADER + length);
+	return NULL;
+}
+
+/**
+ * Returns the expiry time of the stored 'data' or zero if it doesn't expire
+ */
+time_t record_expiry(DATA *data)
+{
+	const unsigned char *header = DATA_PTR(*data);
+	uint64_t expiry;
+	int i;
+
+	if (DATA_SZ(*data) < RECORD_EXPIRY_HEADER || header[0] != RECORD_EXPIRY_MARK)
+		return 0;
+	for (expiry = 0, i = 1 ; i < RECORD_EXPIRY_HEADER ; i++)
+		expiry = expiry << 8 | header[i];
+	return (time_t)expiry;
+}
+
+/**
+ * Returns the json text of the stored 'data'
+ */
+const char *record_text(DATA *data)
+{
+	return &DATA_STR(*data)[record_expiry(data) ? RECORD_EXPIRY_HEADER : 0];
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+
+#include "xdb.h"
+#include "appids.h"
+
+struct json_object;
+
+/*
+ * A value that expires is stored after a header: the byte
+ * RECORD_EXPIRY_MARK, that can't start a json text, then its expiry
+ * time in seconds since the epoch on 8 bytes, big endian.
+ */
+#define RECORD_EXPIRY_MARK	'\001'
+#define RECORD_EXPIRY_HEADER	9
+
+extern const char *record_key(const struct appid *app, const char *ukey, size_t nnul, void *(*alloc)(size_t), DATA *key);
+extern const char *record_value(struct json_object *value, time_t expiry, DATA *data);
+extern time_t record_expiry(DATA *data);
+extern const char *record_text(DATA *data);
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "scratch.h"
+
+/*
+ * Scratch memory of the requests. Each thread allocates in its own arena
+ * by moving a pointer in its current chunk and releases everything at
+ * once by 'scratch_reset' when it starts a new request. When a chunk is
+ * full, a new chunk of at least the double size is chained. The reset
+ * keeps only the last chunk, the largest, so that after a few requests
+ * the arena holds its usual request without calling malloc any more.
+ * The chunks of an exiting thread are freed.
+ */
+#define CHUNK_MIN	16384
+#define ALIGN		(sizeof(void*) - 1)
+
+struct chunk
+{
+	struct chunk *next;	/* the previous chunk */
+	size_t size;		/* size of data */
+	size_t used;		/* used size of data */
+	char data[];
+};
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static __thread struct chunk *current;
+
+/* frees the chunks from 'chunk' */
+static void release(void *arg)
+{
+	struct chunk *chunk, *next;
+
+	for (chunk = arg ; chunk ; chunk = next)
+	{
+		next = chunk->next;
+		free(chunk);
+	}
+}
+
+static void make_key()
+{
+	pthread_key_create(&key, release);
+}
+
+/**
+ * Returns 'size' bytes of the arena of the calling thread, aligned for
+ * pointers, valid until its next reset, or NULL if out of memory
+ */
+void *scratch_alloc(size_t size)
+{
+	struct chunk *chunk;
+	size_t n;
+	void *result;
+
+	size = (size + ALIGN) & ~ALIGN;
+	chunk = current;
+	if (!chunk || chunk->size - chunk->used < size)
+	{
+		n = chunk ? 2 * chunk->size : CHUNK_MIN;
+		chunk = malloc(sizeof *chunk + (n > size ? n : size));
+		if (!chunk)
+			return NULL;
+		chunk->next = current;
+		chunk->size = n > size ? n : size;
+		chunk->used = 0;
+		if (!current)
+			pthread_once(&once, make_key);
+		current = chunk;
+		pthread_setspecific(key, chunk);
+	}
+	result = &chunk->data[chunk->used];
+	chunk->used += size;
+	return result;
+}
+
+/**
+ * Releases all the scratch memory of the calling thread
+ */
+void scratch_reset()
+{
+	struct chunk *chunk = current;
+
+	if (chunk)
+	{
+		release(chunk->next);
+		chunk->next = NULL;
+		chunk->used = 0;
+	}
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <json-c/json.h>
+
+#define AFB_BINDING_VERSION 2
+#include <afb/afb-binding.h>
+
+#include "watch.h"
+
+#define BUCKETS 64
+
+/*
+ * Index of the watched keys and prefixes of keys.
+ * Each watch has its event to which the watchers subscribe.
+ * A written key is matched by looking up the watch of the whole key
+ * and the watches of its prefixes whose length is in the range of the
+ * lengths of the watched prefixes.
+ */
+struct watch
+{
+	struct watch *next;	/* next in the bucket */
+	struct afb_event event;	/* the event of the watch */
+	int prefix;		/* is the pattern a prefix? */
+	uint32_t hash;		/* hash of the pattern */
+	size_t size;		/* size of the pattern */
+	char pattern[];		/* the pattern */
+};
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct watch *buckets[BUCKETS];
+static size_t count;
+static size_t prefix_min = SIZE_MAX;
+static size_t prefix_max;
+
+static uint32_t hash_pattern(const void *pattern, size_t size, int prefix)
+{
+	const unsigned char *p = pattern;
+	uint32_t h = prefix ? 2166136261u : 84696351u;
+
+	while (size--)
+		h = (h ^ *p++) * 16777619u;
+	return h;
+}
+
+/* returns the pointer to the link that points the watch of pattern */
+static struct watch **search(const void *pattern, size_t size, int prefix, uint32_t hash)
+{
+	struct watch **prv, *w;
+
+	prv = &buckets[hash % BUCKETS];
+	while ((w = *prv) && (w->hash != hash || w->size != size || w->prefix != prefix || memcmp(w->pattern, pattern, size)))
+		prv = &w->next;
+	return prv;
+}
+
+static void remove_watch(struct watch **prv)
+{
+	struct watch *w = *prv;
+
+	*prv = w->next;
+	afb_event_drop(w->event);
+	free(w);
+	count--;
+}
+
+/**
+ * Subscribes 'req' to the changes of the key 'pattern' or of the keys
+ * beginning with 'pattern' when 'prefix' isn't zero
+ */
+int watch_subscribe(struct afb_req req, const void *pattern, size_t size, int prefix)
+{
+	uint32_t hash;
+	struct watch *w, **prv;
+	int ret;
+
+	hash = hash_pattern(pattern, size, prefix);
+	pthread_mutex_lock(&mutex);
+	prv = search(pattern, size, prefix, hash);
+	w = *prv;
+	if (!w)
+	{
+		w = malloc(sizeof *w + size);
+		if (!w)
+		{
+			pthread_mutex_unlock(&mutex);
+			return -ENOMEM;
+		}
+		w->event = afb_daemon_make_event("changed");
+		if (!afb_event_is_valid(w->event))
+		{
+			free(w);
+			pthread_mutex_unlock(&mutex);
+			return -EINVAL;
+		}
+		w->next = NULL;
+		w->prefix = prefix;
+		w->hash = hash;
+		w->size = size;
+		memcpy(w->pattern, pattern, size);
+		*prv = w;
+		count++;
+		if (prefix)
+		{
+			if (size < prefix_min)
+				prefix_min = size;
+			if (size > prefix_max)
+				prefix_max = size;
+		}
+	}
+	ret = afb_req_subscribe(req, w->event);
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+/**
+ * Unsubscribes 'req' of a previous subscription
+ */
+int watch_unsubscribe(struct afb_req req, const void *pattern, size_t size, int prefix)
+{
+	struct watch *w;
+	int ret;
+
+	pthread_mutex_lock(&mutex);
+	w = *search(pattern, size, prefix, hash_pattern(pattern, size, prefix));
+	ret = w ? afb_req_unsubscribe(req, w->event) : -ENOENT;
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+/*
+ * pushes the change to the watch at 'prv', removing it if nobody watches.
+ * Each event gets its own copy of the value, parsed from 'text': the
+ * events are sent by other threads.
+ */
+static void push(struct watch **prv, const char *key, const char *op, const char *text)
+{
+	struct json_object *change;
+
+	change = json_object_new_object();
+	json_object_object_add(change, "key", json_object_new_string(key));
+	if (text)
+		json_object_object_add(change, "value", json_tokener_parse(text));
+	json_object_object_add(change, "op", json_object_new_string(op));
+	if (afb_event_push((*prv)->event, change) <= 0)
+		remove_watch(prv);
+}
+
+/**
+ * Notifies the watchers of the database key 'key' of size 'size'
+ * (including its tailing null) that it was changed by 'op' to 'value'.
+ * The key reported is the key without its 'skip' first bytes.
+ */
+void watch_notify(const void *key, size_t size, size_t skip, const char *op, struct json_object *value)
+{
+	struct watch **prv;
+	size_t len, max;
+	const char *ukey, *text;
+
+	if (!count)
+		return;
+
+	ukey = (const char*)key + skip;
+	text = value ? json_object_to_json_string_ext(value, JSON_C_TO_STRING_PLAIN) : NULL;
+	pthread_mutex_lock(&mutex);
+	prv = search(key, size, 0, hash_pattern(key, size, 0));
+	if (*prv)
+		push(prv, ukey, op, text);
+	max = size - 1 < prefix_max ? size - 1 : prefix_max;
+	for (len = prefix_min > skip ? prefix_min : skip ; len <= max ; len++)
+	{
+		prv = search(key, len, 1, hash_pattern(key, len, 1));
+		if (*prv)
+			push(prv, ukey, op, text);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Returns the count of watches
+ */
+size_t watch_count()
+{
+	return count;
+}
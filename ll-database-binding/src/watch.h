@@ -0,0 +1,27 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+struct afb_req;
+struct json_object;
+
+extern int watch_subscribe(struct afb_req req, const void *pattern, size_t size, int prefix);
+extern int watch_unsubscribe(struct afb_req req, const void *pattern, size_t size, int prefix);
+extern void watch_notify(const void *key, size_t size, size_t skip, const char *op, struct json_object *value);
+extern size_t watch_count();
@@ -0,0 +1,1571 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#if defined(XDB_STANDALONE)
+# define AFB_ERROR(...)  (fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+# define AFB_INFO(...)   ((void)0)
+#else
+# define AFB_BINDING_VERSION 2
+# include <afb/afb-binding.h>
+#endif
+
+#include "xdb.h"
+
+// ----- Berkeley database -----
+#if USE_BERKELEY_DB
+
+static DB_ENV *environment;
+static DB *database;
+
+/*
+ * The values are read in a buffer of the thread that its next reads
+ * reuse, so that the reads don't allocate. The values larger than
+ * READ_BUFFER_MAX are read in a buffer allocated for them.
+ */
+#define READ_BUFFER_MAX 65536
+
+static pthread_key_t buffer_key;
+static __thread void *read_buffer;
+static __thread uint32_t read_size;
+
+/*
+ * The database is opened in a private environment with locking and
+ * free-threaded handles so that the worker threads of the binder
+ * access it concurrently. Private means that the regions are in the
+ * memory of the process: no region file is created. The environment is
+ * transactional, each write being a transaction of its own unless made
+ * by xdb_apply, and recovered at open from its log. The commits don't
+ * flush the log: xdb_sync does. The home of the environment, where the
+ * log files are, is the directory "<path>.env" of the database.
+ */
+int xdb_open(const char *path)
+{
+	int ret;
+	char *home;
+
+	ret = db_env_create(&environment, 0);
+	if (ret != 0)
+	{
+		AFB_ERROR("Failed to create the environment: %s.", db_strerror(ret));
+		return -1;
+	}
+	environment->set_lk_detect(environment, DB_LOCK_DEFAULT);
+	environment->set_flags(environment, DB_TXN_NOSYNC, 1);
+	environment->log_set_config(environment, DB_LOG_AUTO_REMOVE, 1);
+	pthread_key_create(&buffer_key, free);
+
+	if (asprintf(&home, "%s.env", path) < 0)
+	{
+		AFB_ERROR("Failed to open the environment: out of memory.");
+		environment->close(environment, 0);
+		return -1;
+	}
+	if (mkdir(home, 0700) < 0 && errno != EEXIST)
+	{
+		AFB_ERROR("Failed to create the directory '%s': %s.", home, strerror(errno));
+		free(home);
+		environment->close(environment, 0);
+		return -1;
+	}
+	ret = environment->open(environment, home,
+			DB_CREATE|DB_PRIVATE|DB_INIT_MPOOL|DB_INIT_LOCK|DB_INIT_LOG|DB_INIT_TXN|DB_RECOVER|DB_THREAD, 0600);
+	free(home);
+	if (ret != 0)
+	{
+		AFB_ERROR("Failed to open the environment of '%s': %s.", path, db_strerror(ret));
+		environment->close(environment, 0);
+		return -1;
+	}
+
+	ret = db_create(&database, environment, 0);
+	if (ret != 0)
+	{
+		AFB_ERROR("Failed to create database: %s.", db_strerror(ret));
+		environment->close(environment, 0);
+		return -1;
+	}
+
+	ret = database->open(database, NULL, path, NULL, DB_BTREE, DB_CREATE|DB_THREAD|DB_AUTO_COMMIT, 0600);
+	if (ret != 0)
+	{
+		AFB_ERROR("Failed to open the '%s' database: %s.", path, db_strerror(ret));
+		database->close(database, 0);
+		environment->close(environment, 0);
+		return -1;
+	}
+	return 0;
+}
+
+const char *xdb_strerror(int code)
+{
+	return db_strerror(code);
+}
+
+int xdb_put(DBT *key, DBT *data, int replace)
+{
+	int ret;
+
+	ret = database->put(database, NULL, key, data, replace ? 0 : DB_NOOVERWRITE);
+	if (ret != 0)
+		AFB_ERROR("can't %s key %s with %s: %s", replace ? "replace" : "insert", DATA_STR(*key), DATA_STR(*data), db_strerror(ret));
+	return ret;
+}
+
+int xdb_delete(DBT *key)
+{
+	int ret;
+
+	ret = database->del(database, NULL, key, 0);
+	if (ret != 0)
+		AFB_ERROR("can't delete key %s: %s", DATA_STR(*key), db_strerror(ret));
+	return ret;
+}
+
+int xdb_get(DBT *key, DBT *data)
+{
+	int ret;
+	void *buffer;
+
+	memset(data, 0, sizeof *data);
+	data->flags = DB_DBT_USERMEM;
+	data->data = read_buffer;
+	data->ulen = read_size;
+
+	ret = database->get(database, NULL, key, data, 0);
+	while (ret == DB_BUFFER_SMALL)
+	{
+		/* the size of the value is now in data->size */
+		if (data->size > READ_BUFFER_MAX)
+		{
+			data->flags = DB_DBT_MALLOC;
+			data->data = NULL;
+		}
+		else
+		{
+			buffer = realloc(read_buffer, data->size);
+			if (!buffer)
+			{
+				ret = ENOMEM;
+				break;
+			}
+			pthread_setspecific(buffer_key, buffer);
+			read_buffer = data->data = buffer;
+			read_size = data->ulen = data->size;
+		}
+		ret = database->get(database, NULL, key, data, 0);
+	}
+	if (ret != 0 && ret != XDB_NOTFOUND)
+		AFB_ERROR("can't get key %s: %s", DATA_STR(*key), db_strerror(ret));
+	return ret;
+}
+
+/* releases the data returned by xdb_get or xdb_get_part */
+void xdb_release(DBT *data)
+{
+	if (data->data != read_buffer)
+		free(data->data);
+}
+
+/* reads 'length' bytes at 'offset' of the value without reading the others */
+int xdb_get_part(DBT *key, size_t offset, size_t length, DBT *data, size_t *size)
+{
+	int ret;
+
+	/* a null user buffer only gets the size */
+	memset(data, 0, sizeof *data);
+	data->flags = DB_DBT_USERMEM;
+	ret = database->get(database, NULL, key, data, 0);
+	if (ret == DB_BUFFER_SMALL || ret == 0)
+	{
+		*size = data->size;
+		memset(data, 0, sizeof *data);
+		data->flags = DB_DBT_MALLOC|DB_DBT_PARTIAL;
+		data->doff = (uint32_t)(offset < *size ? offset : *size);
+		data->dlen = (uint32_t)(length < *size - data->doff ? length : *size - data->doff);
+		ret = database->get(database, NULL, key, data, 0);
+	}
+	if (ret != 0 && ret != XDB_NOTFOUND)
+		AFB_ERROR("can't get part of key %s: %s", DATA_STR(*key), db_strerror(ret));
+	return ret;
+}
+
+/* walks the btree in key order from 'start' while keys begin with 'prefix' */
+int xdb_scan(DBT *prefix, DBT *start, int withdata, int (*callback)(void*, DBT*, DBT*), void *closure)
+{
+	DBC *cursor;
+	DBT key, data;
+	int ret, stop;
+
+	ret = database->cursor(database, NULL, &cursor, 0);
+	if (ret != 0)
+	{
+		AFB_ERROR("can't create a cursor: %s", db_strerror(ret));
+		return ret;
+	}
+
+	/* positioning on start needs a copy of it that the cursor can reallocate */
+	memset(&key, 0, sizeof key);
+	memset(&data, 0, sizeof data);
+	key.flags = DB_DBT_REALLOC;
+	data.flags = withdata ? DB_DBT_REALLOC : DB_DBT_REALLOC|DB_DBT_PARTIAL; /* dlen=0: values aren't read */
+	key.size = start->size;
+	key.data = malloc(start->size);
+	if (!key.data)
+		ret = ENOMEM;
+	else
+	{
+		memcpy(key.data, start->data, start->size);
+		ret = cursor->get(cursor, &key, &data, DB_SET_RANGE);
+		stop = 0;
+		while (ret == 0 && !stop
+		    && key.size >= prefix->size
+		    && !memcmp(key.data, prefix->data, prefix->size))
+		{
+			stop = callback(closure, &key, &data);
+			if (!stop)
+				ret = cursor->get(cursor, &key, &data, DB_NEXT);
+		}
+		if (ret == DB_NOTFOUND)
+			ret = 0;
+		free(key.data);
+		free(data.data);
+	}
+	if (ret != 0)
+		AFB_ERROR("can't scan %.*s: %s", (int)prefix->size, DATA_STR(*prefix), db_strerror(ret));
+	cursor->close(cursor);
+	return ret;
+}
+
+/*
+ * The log makes the commits durable. A checkpoint, when the log grew by
+ * CHECKPOINT_KBYTES since the last one, writes the pages of the
+ * database and lets the old log files be removed.
+ */
+#define CHECKPOINT_KBYTES  1024
+
+int xdb_sync()
+{
+	int ret;
+
+	ret = environment->log_flush(environment, NULL);
+	if (ret == 0)
+		ret = environment->txn_checkpoint(environment, CHECKPOINT_KBYTES, 0, 0);
+	if (ret != 0)
+		AFB_ERROR("can't sync the database: %s", db_strerror(ret));
+	return ret;
+}
+
+int xdb_checkpoint()
+{
+	int ret;
+
+	ret = environment->txn_checkpoint(environment, CHECKPOINT_KBYTES, 0, 0);
+	if (ret != 0)
+		AFB_ERROR("can't checkpoint the database: %s", db_strerror(ret));
+	return ret;
+}
+
+/* walks the whole btree: for background use */
+int xdb_usage(struct xdb_usage *usage)
+{
+	int ret;
+	DB_BTREE_STAT *stat;
+
+	ret = database->stat(database, NULL, &stat, 0);
+	if (ret != 0)
+	{
+		AFB_ERROR("can't get the statistics of the database: %s", db_strerror(ret));
+		return ret;
+	}
+	usage->file_size = (unsigned long long)stat->bt_pagecnt * stat->bt_pagesize;
+	usage->free_size = (unsigned long long)stat->bt_free * stat->bt_pagesize
+			+ stat->bt_int_pgfree + stat->bt_leaf_pgfree
+			+ stat->bt_dup_pgfree + stat->bt_over_pgfree;
+	free(stat);
+	return 0;
+}
+
+/*
+ * The btree is compacted range after range, each call freeing at most
+ * COMPACT_PAGES pages, so that its locks are held briefly and that
+ * 'throttle' paces the calls. The emptied pages are returned to the
+ * file system (DB_FREE_SPACE).
+ */
+#define COMPACT_PAGES   32
+
+int xdb_compact(int (*throttle)(void*), void *closure)
+{
+	int ret;
+	DB_COMPACT info;
+	DBT start, end;
+
+	memset(&start, 0, sizeof start);
+	ret = 0;
+	do
+	{
+		memset(&info, 0, sizeof info);
+		info.compact_pages = COMPACT_PAGES;
+		memset(&end, 0, sizeof end);
+		end.flags = DB_DBT_MALLOC;
+		ret = database->compact(database, NULL, start.size ? &start : NULL, NULL, &info, DB_FREE_SPACE, &end);
+		free(start.data);
+		start = end;
+	}
+	while (ret == 0 && start.size && !throttle(closure));
+	free(start.data);
+	if (ret != 0)
+		AFB_ERROR("can't compact the database: %s", db_strerror(ret));
+	return ret;
+}
+
+/*
+ * The records are put by buffers of LOAD_BUFFER bytes of key/data pairs
+ * (DB_MULTIPLE_KEY), a record too large for the buffer is put alone.
+ */
+#define LOAD_BUFFER     (1024 * 1024)
+
+int xdb_load(DBT *keys, DBT *data, size_t count)
+{
+	DBT bulk;
+	void *pointer;
+	size_t i, n;
+	int ret;
+
+	memset(&bulk, 0, sizeof bulk);
+	bulk.ulen = LOAD_BUFFER;
+	bulk.flags = DB_DBT_USERMEM|DB_DBT_BULK;
+	bulk.data = malloc(LOAD_BUFFER);
+	if (!bulk.data)
+		return ENOMEM;
+
+	ret = 0;
+	for (i = 0 ; ret == 0 && i < count ; i += n)
+	{
+		DB_MULTIPLE_WRITE_INIT(pointer, &bulk);
+		for (n = 0 ; i + n < count ; n++)
+		{
+			DB_MULTIPLE_KEY_WRITE_NEXT(pointer, &bulk,
+				keys[i + n].data, keys[i + n].size,
+				data[i + n].data, data[i + n].size);
+			if (!pointer)
+				break;
+		}
+		if (n)
+			ret = database->put(database, NULL, &bulk, NULL, DB_MULTIPLE_KEY);
+		else
+		{
+			ret = database->put(database, NULL, &keys[i], &data[i], 0);
+			n = 1;
+		}
+	}
+	free(bulk.data);
+	if (ret != 0)
+		AFB_ERROR("can't load the records: %s", db_strerror(ret));
+	return ret;
+}
+
+/*
+ * The writes are made in one transaction, restarted at most APPLY_RETRIES
+ * times when chosen as the victim of a deadlock with a reader
+ */
+#define APPLY_RETRIES   3
+
+int xdb_apply(struct xdb_write *writes, size_t count)
+{
+	DB_TXN *txn;
+	size_t i;
+	int ret, retries;
+
+	retries = 0;
+	do
+	{
+		ret = environment->txn_begin(environment, NULL, &txn, 0);
+		if (ret != 0)
+			break;
+		for (i = 0 ; ret == 0 && i < count ; i++)
+		{
+			if (writes[i].data.data)
+				ret = database->put(database, txn, &writes[i].key, &writes[i].data, 0);
+			else if ((ret = database->del(database, txn, &writes[i].key, 0)) == DB_NOTFOUND)
+				ret = 0;
+		}
+		if (ret == 0)
+			ret = txn->commit(txn, 0);
+		else
+			txn->abort(txn);
+	}
+	while (ret == DB_LOCK_DEADLOCK && retries++ < APPLY_RETRIES);
+	if (ret != 0)
+		AFB_ERROR("can't apply the transaction: %s", db_strerror(ret));
+	return ret;
+}
+
+#endif
+
+// ----- gdbm database -----
+#if USE_GDBM
+
+#if GDBM_VERSION_MAJOR > 1 || (GDBM_VERSION_MAJOR == 1 && GDBM_VERSION_MINOR >= 13)
+# define IFSYS(yes,no)   (gdbm_syserr[gdbm_errno] ? (yes) : (no))
+#else
+# define IFSYS(yes,no)   (no)
+#endif
+
+#define BLOCK_SIZE  512
+
+/* a gdbm handle is not thread safe, even for reading: its accesses are serialized */
+static GDBM_FILE database;
+static pthread_mutex_t database_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *filename;
+
+/* while compacting, the keys written are recorded to be copied again */
+static int compacting;
+static datum *dirty;
+static size_t dirty_count, dirty_size;
+static int dirty_lost;
+
+/* records the write of 'key' if compacting, called with database_mutex held */
+static void mark_dirty(datum *key)
+{
+	datum *newdirty;
+	char *copy;
+
+	if (!compacting || dirty_lost)
+		return;
+
+	if (dirty_count == dirty_size)
+	{
+		newdirty = realloc(dirty, (dirty_size ? 2 * dirty_size : 64) * sizeof *dirty);
+		if (!newdirty)
+		{
+			dirty_lost = 1;
+			return;
+		}
+		dirty = newdirty;
+		dirty_size = dirty_size ? 2 * dirty_size : 64;
+	}
+	copy = malloc((size_t)key->dsize);
+	if (!copy)
+	{
+		dirty_lost = 1;
+		return;
+	}
+	memcpy(copy, key->dptr, (size_t)key->dsize);
+	dirty[dirty_count].dptr = copy;
+	dirty[dirty_count++].dsize = key->dsize;
+}
+
+/*
+ * The transactions of xdb_apply are journaled: their writes are appended
+ * to the journal, that is synced, before being stored. The journal is
+ * emptied when the database is synced and replayed at open, so that a
+ * transaction cut by a crash is completed at the next start. The
+ * journal holds the transactions synced since the database, each one
+ * being, the sizes as varints:
+ *   count of writes
+ *   for each write: 'P' key size, key, data size, data
+ *               or: 'D' key size, key
+ *   FNV-1a hash of the bytes of the transaction on 4 bytes
+ * A torn transaction at the end of the journal fails its hash and is
+ * ignored: it was never stored.
+ */
+static int journal = -1;
+static size_t journal_size;
+static int journal_keep;	/* a transaction failed to be stored: keep it for replay */
+
+static size_t put_varint(unsigned char *buffer, size_t value)
+{
+	size_t n = 0;
+
+	while (value >= 0x80)
+	{
+		buffer[n++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	buffer[n++] = (unsigned char)value;
+	return n;
+}
+
+/* reads in 'value' the varint at '*pointer', returns 0 or -1 if beyond 'end' */
+static int get_varint(const unsigned char **pointer, const unsigned char *end, size_t *value)
+{
+	const unsigned char *p = *pointer;
+	unsigned shift = 0;
+
+	*value = 0;
+	do
+	{
+		if (p == end || shift >= 8 * sizeof *value)
+			return -1;
+		*value |= (size_t)(*p & 0x7f) << shift;
+		shift += 7;
+	}
+	while (*p++ & 0x80);
+	*pointer = p;
+	return 0;
+}
+
+static uint32_t journal_hash(const unsigned char *bytes, size_t size)
+{
+	uint32_t hash = 2166136261u;
+
+	while (size--)
+		hash = (hash ^ *bytes++) * 16777619u;
+	return hash;
+}
+
+/* appends the transaction of 'writes' to the journal and syncs it, called with database_mutex held */
+static int journal_write(struct xdb_write *writes, size_t count)
+{
+	unsigned char *buffer, *p;
+	size_t i, size;
+	ssize_t len;
+	uint32_t hash;
+
+	size = 10 + 4;
+	for (i = 0 ; i < count ; i++)
+		size += 1 + 10 + (size_t)writes[i].key.dsize + (writes[i].data.dptr ? 10 + (size_t)writes[i].data.dsize : 0);
+	buffer = malloc(size);
+	if (!buffer)
+		return GDBM_MALLOC_ERROR;
+
+	p = buffer + put_varint(buffer, count);
+	for (i = 0 ; i < count ; i++)
+	{
+		*p++ = writes[i].data.dptr ? 'P' : 'D';
+		p += put_varint(p, (size_t)writes[i].key.dsize);
+		memcpy(p, writes[i].key.dptr, (size_t)writes[i].key.dsize);
+		p += writes[i].key.dsize;
+		if (writes[i].data.dptr)
+		{
+			p += put_varint(p, (size_t)writes[i].data.dsize);
+			memcpy(p, writes[i].data.dptr, (size_t)writes[i].data.dsize);
+			p += writes[i].data.dsize;
+		}
+	}
+	hash = journal_hash(buffer, (size_t)(p - buffer));
+	for (i = 0 ; i < 4 ; i++)
+		*p++ = (unsigned char)(hash >> (24 - 8 * i));
+	size = (size_t)(p - buffer);
+
+	for (i = 0 ; i < size ; i += (size_t)len)
+	{
+		len = pwrite(journal, buffer + i, size - i, (off_t)(journal_size + i));
+		if (len < 0 && errno != EINTR)
+			break;
+		if (len < 0)
+			len = 0;
+	}
+	free(buffer);
+	if (i < size || fdatasync(journal) < 0)
+	{
+		/* a torn transaction would be ignored but would hide the next ones */
+		if (ftruncate(journal, (off_t)journal_size) < 0)
+			journal_keep = 1;
+		return GDBM_FILE_WRITE_ERROR;
+	}
+	journal_size += size;
+	return 0;
+}
+
+/* empties the journal, called with database_mutex held after syncing the database */
+static void journal_clear()
+{
+	if (!journal_size || journal_keep)
+		return;
+	if (ftruncate(journal, 0) < 0 || fdatasync(journal) < 0)
+		AFB_ERROR("can't empty the journal: %s", strerror(errno));
+	else
+		journal_size = 0;
+}
+
+/* reads the write at '*pointer' in 'key' and 'data', returns 0 or -1 if invalid */
+static int journal_parse(const unsigned char **pointer, const unsigned char *end, datum *key, datum *data)
+{
+	const unsigned char *p = *pointer;
+	size_t size;
+	int op;
+
+	if (p == end)
+		return -1;
+	op = *p++;
+	if ((op != 'P' && op != 'D') || get_varint(&p, end, &size) < 0 || size > (size_t)(end - p))
+		return -1;
+	DATA_SET(key, p, size);
+	p += size;
+	DATA_SET(data, NULL, 0);
+	if (op == 'P')
+	{
+		if (get_varint(&p, end, &size) < 0 || size > (size_t)(end - p))
+			return -1;
+		DATA_SET(data, p, size);
+		p += size;
+	}
+	*pointer = p;
+	return 0;
+}
+
+/* stores 'data' for 'key' or removes 'key' if 'data' is NULL, called with database_mutex held */
+static int store_write(datum *key, datum *data)
+{
+	if (data->dptr ? gdbm_store(database, *key, *data, GDBM_REPLACE) != 0
+	               : gdbm_delete(database, *key) != 0 && gdbm_errno != GDBM_ITEM_NOT_FOUND)
+		return gdbm_errno;
+	mark_dirty(key);
+	return 0;
+}
+
+/* stores the writes of the complete transactions of the journal, at open */
+static int journal_replay()
+{
+	struct stat st;
+	unsigned char *buffer;
+	const unsigned char *p, *q, *end;
+	datum key, data;
+	size_t count, i;
+	ssize_t len;
+	uint32_t hash;
+	int ret;
+
+	if (fstat(journal, &st) < 0)
+		return GDBM_FILE_STAT_ERROR;
+	journal_size = (size_t)st.st_size;
+	if (!journal_size)
+		return 0;
+	buffer = malloc(journal_size);
+	if (!buffer)
+		return GDBM_MALLOC_ERROR;
+	for (i = 0 ; i < journal_size ; i += (size_t)len)
+	{
+		len = pread(journal, buffer + i, journal_size - i, (off_t)i);
+		if (len == 0 || (len < 0 && errno != EINTR))
+			break;
+		if (len < 0)
+			len = 0;
+	}
+	if (i < journal_size)
+	{
+		free(buffer);
+		return GDBM_FILE_READ_ERROR;
+	}
+
+	/* each transaction is checked whole then stored */
+	ret = 0;
+	end = buffer + journal_size;
+	for (p = buffer ; ret == 0 && p < end ; p += 4)
+	{
+		q = p;
+		if (get_varint(&p, end, &count) < 0)
+			break;
+		for (i = 0 ; i < count && journal_parse(&p, end, &key, &data) == 0 ; i++);
+		if (i < count || end - p < 4)
+			break;
+		hash = journal_hash(q, (size_t)(p - q));
+		if (p[0] != (unsigned char)(hash >> 24) || p[1] != (unsigned char)(hash >> 16)
+		 || p[2] != (unsigned char)(hash >> 8) || p[3] != (unsigned char)hash)
+			break;
+
+		get_varint(&q, end, &count);
+		for (i = 0 ; ret == 0 && i < count ; i++)
+		{
+			journal_parse(&q, end, &key, &data);
+			ret = store_write(&key, &data);
+		}
+	}
+	free(buffer);
+	if (ret == 0)
+	{
+		gdbm_sync(database);
+		journal_clear();
+	}
+	return ret;
+}
+
+static void onfatal(const char *text)
+{
+	AFB_ERROR("fatal gdbm message: %s", text);
+}
+
+int xdb_open(const char *path)
+{
+	int ret;
+	char *name;
+
+	filename = strdup(path);
+	if (!filename)
+	{
+		AFB_ERROR("Fail to open/create database: out of memory");
+		return -1;
+	}
+	database = gdbm_open(path, BLOCK_SIZE, GDBM_WRCREAT, 0600, onfatal);
+	if (!database)
+	{
+		AFB_ERROR("Fail to open/create database: %s%s%s",
+			gdbm_errlist[gdbm_errno],
+			IFSYS(", ", ""),
+			IFSYS(strerror(errno), ""));
+		return -1;
+		
+	}
+
+	if (asprintf(&name, "%s.journal", path) < 0)
+	{
+		AFB_ERROR("Fail to open the journal: out of memory");
+		return -1;
+	}
+	journal = open(name, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+	ret = journal < 0 ? GDBM_FILE_OPEN_ERROR : journal_replay();
+	if (ret != 0)
+	{
+		AFB_ERROR("Fail to replay the journal %s: %s", name, gdbm_errlist[ret]);
+		free(name);
+		return -1;
+	}
+	free(name);
+	return 0;
+}
+
+const char *xdb_strerror(int code)
+{
+	return code == XDB_KEYEXIST ? "key already exists" : gdbm_errlist[code];
+}
+
+int xdb_put(datum *key, datum *data, int replace)
+{
+	int ret, err;
+
+	pthread_mutex_lock(&database_mutex);
+	ret = gdbm_store(database, *key, *data, replace ? GDBM_REPLACE : GDBM_INSERT);
+	err = ret > 0 ? XDB_KEYEXIST : gdbm_errno;
+	if (ret == 0)
+		mark_dirty(key);
+	pthread_mutex_unlock(&database_mutex);
+	if (ret == 0)
+		return 0;
+
+	AFB_ERROR("can't %s key %s with %s: %s%s%s",
+		replace ? "replace" : "insert",
+		DATA_STR(*key),
+		DATA_STR(*data),
+		xdb_strerror(err),
+		IFSYS(", ", ""),
+		IFSYS(strerror(errno), ""));
+	return err;
+}
+
+int xdb_delete(datum *key)
+{
+	int ret, err;
+
+	pthread_mutex_lock(&database_mutex);
+	ret = gdbm_delete(database, *key);
+	err = gdbm_errno;
+	if (ret == 0)
+		mark_dirty(key);
+	pthread_mutex_unlock(&database_mutex);
+	if (ret == 0)
+		return 0;
+
+	AFB_ERROR("can't delete key %s: %s%s%s",
+		DATA_STR(*key),
+		gdbm_errlist[err],
+		IFSYS(", ", ""),
+		IFSYS(strerror(errno), ""));
+	return err;
+}
+
+int xdb_get(datum *key, datum *data)
+{
+	int err;
+
+	pthread_mutex_lock(&database_mutex);
+	*data = gdbm_fetch(database, *key);
+	err = gdbm_errno;
+	pthread_mutex_unlock(&database_mutex);
+	if (data->dptr)
+		return 0;
+	if (err == XDB_NOTFOUND)
+		return err;
+
+	AFB_ERROR("can't get key %s: %s%s%s",
+		DATA_STR(*key),
+		gdbm_errlist[err],
+		IFSYS(", ", ""),
+		IFSYS(strerror(errno), ""));
+	return err;
+}
+
+/* releases the data returned by xdb_get or xdb_get_part */
+void xdb_release(datum *data)
+{
+	free(data->dptr);
+}
+
+/* gdbm has no partial read: the part is moved to the start of the value */
+int xdb_get_part(datum *key, size_t offset, size_t length, datum *data, size_t *size)
+{
+	int ret;
+
+	ret = xdb_get(key, data);
+	if (ret == 0)
+	{
+		*size = (size_t)data->dsize;
+		if (offset > *size)
+			offset = *size;
+		if (length > *size - offset)
+			length = *size - offset;
+		memmove(data->dptr, &data->dptr[offset], length);
+		data->dsize = (int)length;
+	}
+	return ret;
+}
+
+/* same order than the default btree comparison of Berkeley DB */
+static int compare_datum(const void *a, const void *b)
+{
+	const datum *x = a, *y = b;
+	int r = memcmp(x->dptr, y->dptr, (size_t)(x->dsize < y->dsize ? x->dsize : y->dsize));
+	return r ? r : x->dsize - y->dsize;
+}
+
+/* gdbm is a hash: the keys of the prefix are collected and sorted first */
+int xdb_scan(datum *prefix, datum *start, int withdata, int (*callback)(void*, datum*, datum*), void *closure)
+{
+	datum key, next, data, *keys, *newkeys;
+	size_t count, size, i;
+	int stop, ret;
+
+	ret = 0;
+	count = size = 0;
+	keys = NULL;
+	pthread_mutex_lock(&database_mutex);
+	key = gdbm_firstkey(database);
+	while (key.dptr)
+	{
+		next = gdbm_nextkey(database, key);
+		if (key.dsize < prefix->dsize
+		 || memcmp(key.dptr, prefix->dptr, (size_t)prefix->dsize)
+		 || compare_datum(&key, start) < 0)
+			free(key.dptr);
+		else
+		{
+			if (count == size)
+			{
+				size = size ? 2 * size : 64;
+				newkeys = realloc(keys, size * sizeof *keys);
+				if (!newkeys)
+				{
+					free(key.dptr);
+					free(next.dptr);
+					ret = GDBM_MALLOC_ERROR;
+					break;
+				}
+				keys = newkeys;
+			}
+			keys[count++] = key;
+		}
+		key = next;
+	}
+	pthread_mutex_unlock(&database_mutex);
+
+	if (ret == 0)
+	{
+		qsort(keys, count, sizeof *keys, compare_datum);
+		stop = 0;
+		data.dptr = NULL;
+		data.dsize = 0;
+		for (i = 0 ; i < count && !stop ; i++)
+		{
+			if (withdata)
+			{
+				pthread_mutex_lock(&database_mutex);
+				data = gdbm_fetch(database, keys[i]);
+				pthread_mutex_unlock(&database_mutex);
+				if (!data.dptr)
+					continue; /* removed meanwhile */
+			}
+			stop = callback(closure, &keys[i], &data);
+			free(data.dptr);
+			data.dptr = NULL;
+		}
+	}
+	else
+		AFB_ERROR("can't scan %.*s: %s", prefix->dsize, DATA_STR(*prefix), gdbm_errlist[ret]);
+
+	for (i = 0 ; i < count ; i++)
+		free(keys[i].dptr);
+	free(keys);
+	return ret;
+}
+
+int xdb_sync()
+{
+	pthread_mutex_lock(&database_mutex);
+	gdbm_sync(database);
+	journal_clear();
+	pthread_mutex_unlock(&database_mutex);
+	return 0;
+}
+
+/* the journal is only emptied by a sync */
+int xdb_checkpoint()
+{
+	int ret;
+
+	pthread_mutex_lock(&database_mutex);
+	ret = journal_size != 0;
+	pthread_mutex_unlock(&database_mutex);
+	return ret ? xdb_sync() : 0;
+}
+
+/*
+ * gdbm keeps no statistics: the keys are walked, one at a time to let
+ * the other accesses go, and only one value in USAGE_SAMPLE is fetched
+ * to estimate the size of the values. The free size is what neither
+ * the records nor the structures of gdbm use. With blocks of 512 bytes,
+ * the buckets, split when full, and their directory take about 100 to
+ * 120 bytes by record in a new file: USAGE_RECORD bytes are counted by
+ * record, plus USAGE_BLOCKS blocks for the header and the avail table.
+ * This is for background use.
+ */
+#define USAGE_SAMPLE   16
+#define USAGE_RECORD   112
+#define USAGE_BLOCKS   3
+
+int xdb_usage(struct xdb_usage *usage)
+{
+	struct stat st;
+	datum key, next, data;
+	unsigned long long used, keys, values, count, sampled;
+
+	keys = values = count = sampled = 0;
+	pthread_mutex_lock(&database_mutex);
+	key = gdbm_firstkey(database);
+	while (key.dptr)
+	{
+		data.dptr = NULL;
+		if (count++ % USAGE_SAMPLE == 0)
+		{
+			data = gdbm_fetch(database, key);
+			sampled++;
+		}
+		next = gdbm_nextkey(database, key);
+		pthread_mutex_unlock(&database_mutex);
+		keys += (unsigned long long)key.dsize;
+		if (data.dptr)
+			values += (unsigned long long)data.dsize;
+		free(data.dptr);
+		free(key.dptr);
+		key = next;
+		pthread_mutex_lock(&database_mutex);
+	}
+	if (fstat(gdbm_fdesc(database), &st) < 0)
+	{
+		pthread_mutex_unlock(&database_mutex);
+		AFB_ERROR("can't get the size of the database: %s", strerror(errno));
+		return GDBM_FILE_STAT_ERROR;
+	}
+	pthread_mutex_unlock(&database_mutex);
+
+	used = keys + (sampled ? values * count / sampled : 0)
+	     + count * USAGE_RECORD + USAGE_BLOCKS * (unsigned long long)BLOCK_SIZE;
+	usage->file_size = (unsigned long long)st.st_size;
+	usage->free_size = usage->file_size > used ? usage->file_size - used : 0;
+	return 0;
+}
+
+/* releases the recorded writes, called with database_mutex held */
+static void clear_dirty()
+{
+	while (dirty_count)
+		free(dirty[--dirty_count].dptr);
+	free(dirty);
+	dirty = NULL;
+	dirty_size = 0;
+	dirty_lost = 0;
+	compacting = 0;
+}
+
+/*
+ * The records are copied, one at a time, into a new file that replaces
+ * the database. The keys are collected first, as for scanning, then the
+ * records written meanwhile are copied again before swapping the files.
+ * 'throttle' paces the copy every COMPACT_RECORDS records.
+ */
+#define COMPACT_RECORDS  64
+
+int xdb_compact(int (*throttle)(void*), void *closure)
+{
+	GDBM_FILE copy;
+	datum key, next, data, *keys, *newkeys;
+	size_t count, size, i;
+	int ret;
+	char *tmpname;
+
+	if (asprintf(&tmpname, "%s.compact", filename) < 0)
+		return GDBM_MALLOC_ERROR;
+	copy = gdbm_open(tmpname, BLOCK_SIZE, GDBM_NEWDB, 0600, onfatal);
+	if (!copy)
+	{
+		ret = gdbm_errno;
+		AFB_ERROR("can't create %s: %s", tmpname, gdbm_errlist[ret]);
+		free(tmpname);
+		return ret;
+	}
+
+	/* collect the keys and start recording the writes */
+	ret = 0;
+	count = size = 0;
+	keys = NULL;
+	pthread_mutex_lock(&database_mutex);
+	compacting = 1;
+	key = gdbm_firstkey(database);
+	while (key.dptr)
+	{
+		next = gdbm_nextkey(database, key);
+		if (count == size)
+		{
+			size = size ? 2 * size : 64;
+			newkeys = realloc(keys, size * sizeof *keys);
+			if (!newkeys)
+			{
+				free(key.dptr);
+				free(next.dptr);
+				ret = GDBM_MALLOC_ERROR;
+				break;
+			}
+			keys = newkeys;
+		}
+		keys[count++] = key;
+		key = next;
+	}
+	pthread_mutex_unlock(&database_mutex);
+
+	/* copy the records */
+	for (i = 0 ; i < count && ret == 0 ; i++)
+	{
+		pthread_mutex_lock(&database_mutex);
+		data = gdbm_fetch(database, keys[i]);
+		pthread_mutex_unlock(&database_mutex);
+		if (data.dptr && gdbm_store(copy, keys[i], data, GDBM_REPLACE) != 0)
+			ret = gdbm_errno;
+		free(data.dptr);
+		if (ret == 0 && (i + 1) % COMPACT_RECORDS == 0 && throttle(closure))
+			ret = -1;
+	}
+	for (i = 0 ; i < count ; i++)
+		free(keys[i].dptr);
+	free(keys);
+
+	/* copy the records written meanwhile and swap the files */
+	pthread_mutex_lock(&database_mutex);
+	if (ret == 0 && dirty_lost)
+		ret = GDBM_MALLOC_ERROR;
+	for (i = 0 ; i < dirty_count && ret == 0 ; i++)
+	{
+		data = gdbm_fetch(database, dirty[i]);
+		if (data.dptr)
+			ret = gdbm_store(copy, dirty[i], data, GDBM_REPLACE) ? gdbm_errno : 0;
+		else
+			gdbm_delete(copy, dirty[i]);
+		free(data.dptr);
+	}
+	if (ret == 0)
+	{
+		gdbm_sync(copy);
+		if (rename(tmpname, filename) < 0)
+			ret = GDBM_FILE_WRITE_ERROR;
+	}
+	if (ret == 0)
+	{
+		gdbm_close(database);
+		database = copy;
+	}
+	clear_dirty();
+	pthread_mutex_unlock(&database_mutex);
+
+	if (ret != 0)
+	{
+		gdbm_close(copy);
+		unlink(tmpname);
+		if (ret > 0)
+			AFB_ERROR("can't compact the database: %s", gdbm_errlist[ret]);
+	}
+	free(tmpname);
+	return ret;
+}
+
+/* gdbm is a hash: the order of the records doesn't help, they are stored in one lock */
+int xdb_load(datum *keys, datum *data, size_t count)
+{
+	size_t i;
+	int ret;
+
+	ret = 0;
+	pthread_mutex_lock(&database_mutex);
+	for (i = 0 ; ret == 0 && i < count ; i++)
+	{
+		if (gdbm_store(database, keys[i], data[i], GDBM_REPLACE) == 0)
+			mark_dirty(&keys[i]);
+		else
+			ret = gdbm_errno;
+	}
+	pthread_mutex_unlock(&database_mutex);
+	if (ret != 0)
+		AFB_ERROR("can't load the records: %s", gdbm_errlist[ret]);
+	return ret;
+}
+
+/*
+ * The writes are journaled then stored. If storing fails, the
+ * transaction stays in the journal to be completed at the next start.
+ */
+int xdb_apply(struct xdb_write *writes, size_t count)
+{
+	size_t i;
+	int ret;
+
+	pthread_mutex_lock(&database_mutex);
+	ret = journal_write(writes, count);
+	for (i = 0 ; ret == 0 && i < count ; i++)
+		ret = store_write(&writes[i].key, &writes[i].data);
+	if (ret != 0 && i)
+		journal_keep = 1;
+	pthread_mutex_unlock(&database_mutex);
+	if (ret != 0)
+		AFB_ERROR("can't apply the transaction: %s%s", gdbm_errlist[ret],
+			i ? ", it will be completed at the next start" : "");
+	return ret;
+}
+#endif
+
+// ----- LMDB database -----
+#if USE_LMDB
+
+#if !defined(LMDB_MAPSIZE)
+# define LMDB_MAPSIZE    (64 * 1024 * 1024)
+#endif
+
+/*
+ * The database is memory mapped. Values are read in place, without
+ * copy, within a read transaction that each thread keeps and renews
+ * (MDB_NOTLS lets a thread have other read transactions, as scans).
+ * Commits don't sync: syncing is made by xdb_sync.
+ * The map has LMDB_MAPSIZE bytes or the MiB given by the environment
+ * variable LL_DATABASE_MAP_SIZE. A write that finds it full doubles it
+ * and is retried. The map can't move under a transaction: the reads,
+ * from xdb_get to xdb_release, and the transactions hold 'map_lock' for
+ * reading, only the growth holds it for writing. A thread in a read
+ * doesn't grow the map, its write fails.
+ */
+static MDB_env *environment;
+static MDB_dbi database;
+static pthread_key_t reader_key;
+static pthread_rwlock_t map_lock = PTHREAD_RWLOCK_INITIALIZER;
+static size_t map_size = LMDB_MAPSIZE;
+static __thread int map_readers;	/* count of reads held by the thread */
+
+static void map_enter()
+{
+	pthread_rwlock_rdlock(&map_lock);
+	map_readers++;
+}
+
+static void map_leave()
+{
+	map_readers--;
+	pthread_rwlock_unlock(&map_lock);
+}
+
+/*
+ * Doubles the map, found full by a transaction whose map had 'size'
+ * bytes, that is ended, unless another thread did it meanwhile
+ * Returns 0 on success or an error code
+ */
+static int map_grow(size_t size)
+{
+	int ret;
+
+	if (map_readers)
+		return MDB_MAP_FULL;
+	pthread_rwlock_wrlock(&map_lock);
+	ret = 0;
+	if (map_size == size)
+	{
+		ret = mdb_env_set_mapsize(environment, 2 * size);
+		if (ret == 0)
+		{
+			map_size = 2 * size;
+			AFB_INFO("map of the database grown to %zu MiB", map_size >> 20);
+		}
+	}
+	pthread_rwlock_unlock(&map_lock);
+	return ret;
+}
+
+/* reads the size of the map in MiB from the environment */
+static int map_init()
+{
+	const char *env;
+	char *end;
+	unsigned long mib;
+
+	env = secure_getenv("LL_DATABASE_MAP_SIZE");
+	if (!env)
+		return 0;
+	mib = strtoul(env, &end, 10);
+	if (*end || end == env || !mib || mib > SIZE_MAX >> 21)
+	{
+		AFB_ERROR("Invalid LL_DATABASE_MAP_SIZE: %s", env);
+		return -1;
+	}
+	map_size = (size_t)mib << 20;
+	return 0;
+}
+
+static void reader_destroy(void *txn)
+{
+	mdb_txn_abort(txn);
+}
+
+int xdb_open(const char *path)
+{
+	int ret;
+	MDB_txn *txn;
+
+	if (map_init() < 0)
+		return -1;
+
+	ret = pthread_key_create(&reader_key, reader_destroy);
+	if (ret != 0)
+	{
+		AFB_ERROR("Failed to create the reader key: %s.", strerror(ret));
+		return -1;
+	}
+
+	ret = mdb_env_create(&environment);
+	if (ret != 0)
+	{
+		AFB_ERROR("Failed to create the environment: %s.", mdb_strerror(ret));
+		return -1;
+	}
+
+	mdb_env_set_mapsize(environment, map_size);
+	ret = mdb_env_open(environment, path, MDB_NOSUBDIR|MDB_NOTLS|MDB_NOSYNC, 0600);
+	if (ret != 0)
+	{
+		AFB_ERROR("Failed to open the '%s' database: %s.", path, mdb_strerror(ret));
+		mdb_env_close(environment);
+		return -1;
+	}
+
+	ret = mdb_txn_begin(environment, NULL, 0, &txn);
+	if (ret == 0)
+	{
+		ret = mdb_dbi_open(txn, NULL, 0, &database);
+		if (ret == 0)
+			ret = mdb_txn_commit(txn);
+		else
+			mdb_txn_abort(txn);
+	}
+	if (ret != 0)
+	{
+		AFB_ERROR("Failed to open the '%s' database: %s.", path, mdb_strerror(ret));
+		mdb_env_close(environment);
+		return -1;
+	}
+	return 0;
+}
+
+const char *xdb_strerror(int code)
+{
+	return mdb_strerror(code);
+}
+
+/* runs one put or delete in its own write transaction */
+static int write_txn(MDB_val *key, MDB_val *data, unsigned flags)
+{
+	int ret;
+	size_t size;
+	MDB_txn *txn;
+
+	do
+	{
+		map_enter();
+		size = map_size;
+		ret = mdb_txn_begin(environment, NULL, 0, &txn);
+		if (ret == 0)
+		{
+			ret = data ? mdb_put(txn, database, key, data, flags) : mdb_del(txn, database, key, NULL);
+			if (ret == 0)
+				ret = mdb_txn_commit(txn);
+			else
+				mdb_txn_abort(txn);
+		}
+		map_leave();
+	}
+	while (ret == MDB_MAP_FULL && map_grow(size) == 0);
+	return ret;
+}
+
+int xdb_put(MDB_val *key, MDB_val *data, int replace)
+{
+	int ret;
+
+	ret = write_txn(key, data, replace ? 0 : MDB_NOOVERWRITE);
+	if (ret != 0)
+		AFB_ERROR("can't %s key %s with %s: %s", replace ? "replace" : "insert", DATA_STR(*key), DATA_STR(*data), mdb_strerror(ret));
+	return ret;
+}
+
+int xdb_delete(MDB_val *key)
+{
+	int ret;
+
+	ret = write_txn(key, NULL, 0);
+	if (ret != 0)
+		AFB_ERROR("can't delete key %s: %s", DATA_STR(*key), mdb_strerror(ret));
+	return ret;
+}
+
+/* the data points into the map until xdb_release */
+int xdb_get(MDB_val *key, MDB_val *data)
+{
+	int ret;
+	MDB_txn *txn;
+
+	map_enter();
+	txn = pthread_getspecific(reader_key);
+	if (txn)
+		ret = mdb_txn_renew(txn);
+	else
+	{
+		ret = mdb_txn_begin(environment, NULL, MDB_RDONLY, &txn);
+		if (ret == 0)
+			pthread_setspecific(reader_key, txn);
+	}
+	if (ret == 0)
+	{
+		ret = mdb_get(txn, database, key, data);
+		if (ret != 0)
+			mdb_txn_reset(txn);
+	}
+	if (ret != 0)
+		map_leave();
+	if (ret != 0 && ret != XDB_NOTFOUND)
+		AFB_ERROR("can't get key %s: %s", DATA_STR(*key), mdb_strerror(ret));
+	return ret;
+}
+
+/* releases the data returned by xdb_get or xdb_get_part */
+void xdb_release(MDB_val *data)
+{
+	mdb_txn_reset(pthread_getspecific(reader_key));
+	map_leave();
+}
+
+/* the part is read in place */
+int xdb_get_part(MDB_val *key, size_t offset, size_t length, MDB_val *data, size_t *size)
+{
+	int ret;
+
+	ret = xdb_get(key, data);
+	if (ret == 0)
+	{
+		*size = data->mv_size;
+		if (offset > *size)
+			offset = *size;
+		if (length > *size - offset)
+			length = *size - offset;
+		data->mv_data = (char*)data->mv_data + offset;
+		data->mv_size = length;
+	}
+	return ret;
+}
+
+/* walks the b+tree in key order from 'start' while keys begin with 'prefix' */
+int xdb_scan(MDB_val *prefix, MDB_val *start, int withdata, int (*callback)(void*, MDB_val*, MDB_val*), void *closure)
+{
+	int ret, stop;
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_val key, data;
+
+	map_enter();
+	ret = mdb_txn_begin(environment, NULL, MDB_RDONLY, &txn);
+	if (ret == 0)
+	{
+		ret = mdb_cursor_open(txn, database, &cursor);
+		if (ret == 0)
+		{
+			/* empty keys are invalid for lmdb */
+			key = *start;
+			ret = mdb_cursor_get(cursor, &key, &data, key.mv_size ? MDB_SET_RANGE : MDB_FIRST);
+			stop = 0;
+			while (ret == 0 && !stop
+			    && key.mv_size >= prefix->mv_size
+			    && !memcmp(key.mv_data, prefix->mv_data, prefix->mv_size))
+			{
+				stop = callback(closure, &key, &data);
+				if (!stop)
+					ret = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+			}
+			if (ret == MDB_NOTFOUND)
+				ret = 0;
+			mdb_cursor_close(cursor);
+		}
+		mdb_txn_abort(txn);
+	}
+	map_leave();
+	if (ret != 0)
+		AFB_ERROR("can't scan %.*s: %s", (int)prefix->mv_size, DATA_STR(*prefix), mdb_strerror(ret));
+	return ret;
+}
+
+int xdb_sync()
+{
+	int ret;
+
+	ret = mdb_env_sync(environment, 1);
+	if (ret != 0)
+		AFB_ERROR("can't sync the database: %s", mdb_strerror(ret));
+	return ret;
+}
+
+/* there is no log */
+int xdb_checkpoint()
+{
+	return 0;
+}
+
+int xdb_usage(struct xdb_usage *usage)
+{
+	int ret, fd;
+	unsigned long long used;
+	MDB_txn *txn;
+	MDB_stat stat;
+	struct stat st;
+
+	map_enter();
+	ret = mdb_txn_begin(environment, NULL, MDB_RDONLY, &txn);
+	if (ret == 0)
+	{
+		ret = mdb_stat(txn, database, &stat);
+		mdb_txn_abort(txn);
+	}
+	map_leave();
+	if (ret == 0)
+		ret = mdb_env_get_fd(environment, &fd);
+	if (ret == 0 && fstat(fd, &st) < 0)
+		ret = errno;
+	if (ret != 0)
+	{
+		AFB_ERROR("can't get the usage of the database: %s", mdb_strerror(ret));
+		return ret;
+	}
+	used = (unsigned long long)stat.ms_psize
+		* (stat.ms_branch_pages + stat.ms_leaf_pages + stat.ms_overflow_pages);
+	usage->file_size = (unsigned long long)st.st_size;
+	usage->free_size = usage->file_size > used ? usage->file_size - used : 0;
+	return 0;
+}
+
+/* a compacted copy would need the read transactions of all threads closed */
+int xdb_compact(int (*throttle)(void*), void *closure)
+{
+	return ENOTSUP;
+}
+
+/*
+ * The records are put in one transaction, appended without searching
+ * the tree while they come after the last key
+ */
+int xdb_load(MDB_val *keys, MDB_val *data, size_t count)
+{
+	int ret;
+	size_t i, size;
+	MDB_txn *txn;
+
+	do
+	{
+		map_enter();
+		size = map_size;
+		ret = mdb_txn_begin(environment, NULL, 0, &txn);
+		if (ret == 0)
+		{
+			for (i = 0 ; ret == 0 && i < count ; i++)
+			{
+				ret = mdb_put(txn, database, &keys[i], &data[i], MDB_APPEND);
+				if (ret == MDB_KEYEXIST)
+					ret = mdb_put(txn, database, &keys[i], &data[i], 0);
+			}
+			if (ret == 0)
+				ret = mdb_txn_commit(txn);
+			else
+				mdb_txn_abort(txn);
+		}
+		map_leave();
+	}
+	while (ret == MDB_MAP_FULL && map_grow(size) == 0);
+	if (ret != 0)
+		AFB_ERROR("can't load the records: %s", mdb_strerror(ret));
+	return ret;
+}
+
+/* the writes are made in one write transaction */
+int xdb_apply(struct xdb_write *writes, size_t count)
+{
+	int ret;
+	size_t i, size;
+	MDB_txn *txn;
+
+	do
+	{
+		map_enter();
+		size = map_size;
+		ret = mdb_txn_begin(environment, NULL, 0, &txn);
+		if (ret == 0)
+		{
+			for (i = 0 ; ret == 0 && i < count ; i++)
+			{
+				if (writes[i].data.mv_data)
+					ret = mdb_put(txn, database, &writes[i].key, &writes[i].data, 0);
+				else if ((ret = mdb_del(txn, database, &writes[i].key, NULL)) == MDB_NOTFOUND)
+					ret = 0;
+			}
+			if (ret == 0)
+				ret = mdb_txn_commit(txn);
+			else
+				mdb_txn_abort(txn);
+		}
+		map_leave();
+	}
+	while (ret == MDB_MAP_FULL && map_grow(size) == 0);
+	if (ret != 0)
+		AFB_ERROR("can't apply the transaction: %s", mdb_strerror(ret));
+	return ret;
+}
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2017 IoT.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Storage layer of the database binding: one of the backends below is
+ * selected at build time. A record is stored with a key and a data
+ * handled through the DATA type and macros of the backend.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(USE_BERKELEY_DB)
+#  undef USE_BERKELEY_DB
+#endif
+
+#if defined(USE_GDBM)
+#  undef USE_GDBM
+#  define USE_GDBM        1
+#else
+#  define USE_GDBM        0
+#endif
+
+#if defined(USE_LMDB)
+#  undef USE_LMDB
+#  define USE_LMDB        1
+#else
+#  define USE_LMDB        0
+#endif
+
+#define USE_BERKELEY_DB   (!USE_GDBM && !USE_LMDB)
+
+// ----- Berkeley database -----
+#if USE_BERKELEY_DB
+
+#include <db.h>
+
+#define DBFILE	"ll-database-binding.db"
+#define DATA	DBT
+#define DATA_SET(k,d,s)  do{memset((k),0,sizeof*(k));(k)->data=(void*)d;(k)->size=(uint32_t)s;}while(0)
+#define DATA_PTR(k)      ((void*)((k).data))
+#define DATA_STR(k)      ((char*)((k).data))
+#define DATA_SZ(k)       ((size_t)((k).size))
+
+#define XDB_NOTFOUND     DB_NOTFOUND
+#define XDB_KEYEXIST     DB_KEYEXIST
+#define XDB_CAN_COMPACT  1
+
+#endif
+
+// ----- gdbm database -----
+#if USE_GDBM
+
+#include <gdbm.h>
+
+#define DBFILE	"ll-database-binding.dbm"
+#define DATA	datum
+#define DATA_SET(k,d,s)  do{(k)->dptr=(char*)d;(k)->dsize=(int)s;}while(0)
+#define DATA_PTR(k)      ((void*)((k).dptr))
+#define DATA_STR(k)      ((char*)((k).dptr))
+#define DATA_SZ(k)       ((size_t)((k).dsize))
+
+#define XDB_NOTFOUND     GDBM_ITEM_NOT_FOUND
+#define XDB_KEYEXIST     GDBM_CANNOT_REPLACE
+#define XDB_CAN_COMPACT  1
+
+#endif
+
+// ----- LMDB database -----
+#if USE_LMDB
+
+#include <lmdb.h>
+
+#define DBFILE	"ll-database-binding.lmdb"
+#define DATA	MDB_val
+#define DATA_SET(k,d,s)  do{(k)->mv_data=(void*)d;(k)->mv_size=(size_t)s;}while(0)
+#define DATA_PTR(k)      ((void*)((k).mv_data))
+#define DATA_STR(k)      ((char*)((k).mv_data))
+#define DATA_SZ(k)       ((size_t)((k).mv_size))
+
+#define XDB_NOTFOUND     MDB_NOTFOUND
+#define XDB_KEYEXIST     MDB_KEYEXIST
+#define XDB_CAN_COMPACT  0	/* freed pages are reused but the file never shrinks */
+
+#endif
+
+struct xdb_usage
+{
+	unsigned long long file_size;	/* size of the file in bytes */
+	unsigned long long free_size;	/* bytes of the file not holding records */
+};
+
+/* a write of a transaction: 'data' for 'key' or, if its pointer is NULL, the removal of 'key' */
+struct xdb_write
+{
+	DATA key;
+	DATA data;
+};
+
+extern int xdb_open(const char *path);
+extern const char *xdb_strerror(int code);
+extern int xdb_put(DATA *key, DATA *data, int replace);
+extern int xdb_delete(DATA *key);
+extern int xdb_get(DATA *key, DATA *data);
+extern void xdb_release(DATA *data);
+extern int xdb_get_part(DATA *key, size_t offset, size_t length, DATA *data, size_t *size);
+extern int xdb_load(DATA *keys, DATA *data, size_t count);
+extern int xdb_apply(struct xdb_write *writes, size_t count);
+extern int xdb_scan(DATA *prefix, DATA *start, int withdata, int (*callback)(void*, DATA*, DATA*), void *closure);
+extern int xdb_sync();
+extern int xdb_checkpoint();
+extern int xdb_usage(struct xdb_usage *usage);
+extern int xdb_compact(int (*throttle)(void*), void *closure);